@@ -42,7 +42,7 @@ vector<DatasetConfig> datasets = {
 int main() {
     string result_filename = "../exp_result/query_vary_N.csv";
     ofstream csv(result_filename);
-    csv << "Scheme,Dataset,N,K,AvgTime_ms,AvgRounds,AvgVolume_Bytes,BlockSize,Access,Self_Access,InitialTime_s\n";
+    csv << "Scheme,Dataset,N,K,AvgTime_ms,AvgRounds,AvgVolume_Bytes,BlockSize,Access,Self_Access,InitialTime_s,Retrieve\n";
 
     std::random_device rd;
     std::mt19937 gen(rd());
@@ -97,6 +97,7 @@ int main() {
             long long total_volume = 0;
             long long total_counter_access = 0;
             long long total_counter_self_healing_acces = 0;
+            long long total_counter_retrieve = 0;
             int actual_queries = min((int)sampled_queries.size(), NUM_QUERIES);
 
             // 执行查询
@@ -107,6 +108,7 @@ int main() {
                 double start_volume = client->communication_volume_;
                 int start_counter_access_ = client->counter_access_;
                 int start_counter_self_healing_access = client->counter_self_healing_access_;
+                int start_counter_retrieve = client->counter_retrieve_;
 
                 auto start_t = high_resolution_clock::now();
                 hotree.SearchTopK(q.x_coord, q.y_coord, q.processed_text, FIXED_K, client);
@@ -118,6 +120,7 @@ int main() {
                 total_volume += (client->communication_volume_ - start_volume);
                 total_counter_access += (client->counter_access_ - start_counter_access_);
                 total_counter_self_healing_acces += (client->counter_self_healing_access_ - start_counter_self_healing_access);
+                total_counter_retrieve += (client->counter_retrieve_ - start_counter_retrieve);
             }
 
             // 计算平均值
@@ -126,6 +129,7 @@ int main() {
             double avg_v = (double)total_volume / actual_queries;
             double avg_a = (double)total_counter_access / actual_queries;
             double avg_as = (double)total_counter_self_healing_acces / actual_queries;
+            double avg_rt = (double)total_counter_retrieve / actual_queries; // 每次查询取回的树节点数
 
             // 写入 CSV (立即写入，无需等待)
             csv << "HOTREE,"
@@ -138,7 +142,8 @@ int main() {
                 << BlockSize << "," 
                 << avg_a << "," 
                 << avg_as <<"," 
-                << initial_time_s << "\n";
+                << initial_time_s << ","
+                << avg_rt << "\n";
             
             // 打印进度
             cout << "  [N=" << setw(5) << n << "] Time: " << fixed << setprecision(2) << avg_t << "ms"<< " oblivious shuffle time: "<< hotree.compute_additional_oblivious_shuffle_time()<<"ms " << endl;
@@ -37,7 +37,7 @@ int main() {
     string result_filename = "../exp_result/query_vary_K.csv";
     ofstream csv(result_filename);
     // 修改表头，增加 InitialTime_s 列
-    csv << "Scheme,Dataset,N,K,AvgTime_ms,AvgRounds,AvgVolume_Bytes,BlockSize,Access,Self_Access,InitialTime_s\n";
+    csv << "Scheme,Dataset,N,K,AvgTime_ms,AvgRounds,AvgVolume_Bytes,BlockSize,Access,Self_Access,InitialTime_s,Retrieve\n";
 
     std::random_device rd;
     std::mt19937 gen(rd());
@@ -83,6 +83,7 @@ int main() {
             long long total_volume = 0;
             long long total_counter_access =  0;
             long long total_counter_self_healing_acces = 0;
+            long long total_counter_retrieve = 0;
 
             // Since each query leads to multiple accesses, this is sufficient to ensure at least N accesses
             for (int i = 0; i < actual_queries; ++i) {
@@ -91,6 +92,7 @@ int main() {
                 double start_volume = client->communication_volume_;
                 int start_counter_access_ = client->counter_access_;
                 int start_counter_self_healing_access = client->counter_self_healing_access_;
+                int start_counter_retrieve = client->counter_retrieve_;
 
                 auto start_t = std::chrono::steady_clock::now();
                 hotree.SearchTopK(q.x_coord, q.y_coord, q.processed_text, k, client);
@@ -102,6 +104,7 @@ int main() {
 
                 total_counter_access += (client->counter_access_ - start_counter_access_);
                 total_counter_self_healing_acces += (client->counter_self_healing_access_ - start_counter_self_healing_access);
+                total_counter_retrieve += (client->counter_retrieve_ - start_counter_retrieve);
             }
 
             double avg_t = (total_time + hotree.compute_additional_oblivious_shuffle_time()) / actual_queries;
@@ -110,9 +113,10 @@ int main() {
             double avg_v = (double)total_volume / actual_queries;
             double avg_a = (double)total_counter_access / actual_queries;
             double avg_as = (double)total_counter_self_healing_acces / actual_queries;
+            double avg_rt = (double)total_counter_retrieve / actual_queries; // 每次查询取回的树节点数
 
             // 在 CSV 写入行末尾增加 initial_time_s
-            csv << "HOTREE," << ds.name << "," << FIXED_N << "," << k << "," << avg_t << "," << avg_r << "," << avg_v << "," << BlockSize << "," << avg_a << "," << avg_as << "," << initial_time_s << "\n";
+            csv << "HOTREE," << ds.name << "," << FIXED_N << "," << k << "," << avg_t << "," << avg_r << "," << avg_v << "," << BlockSize << "," << avg_a << "," << avg_as << "," << initial_time_s << "," << avg_rt << "\n";
             
             cout << "  [K=" << setw(2) << k << "] Time: " << fixed << setprecision(2) << avg_t << "ms" << " oblivious shuffle time: "<< hotree.compute_additional_oblivious_shuffle_time() << "ms" << endl;
             cout<< "stash size max = " <<hotree.stash_max_value<<endl;
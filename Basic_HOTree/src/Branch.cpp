@@ -1,4 +1,5 @@
 #include "Branch.h"
+#include <unordered_map>
 using namespace std;
 
 Branch::Branch() {
@@ -13,7 +14,7 @@ Branch::Branch() {
     is_dummy_for_shuffle = false;
     id = -1;
     partent = NULL;
-    trueData = padZero(trueData);
+    trueData.clear();
     text = "";
 }
 
@@ -29,7 +30,7 @@ Branch::Branch(bool dummy) {
     is_empty_data = dummy;
     id = -1;
     partent = NULL;
-    trueData = padZero(trueData);
+    trueData.clear();
     text = "";
 }
 
@@ -45,7 +46,7 @@ Branch::Branch(bool empty_data, bool dummy_for_shuffle) {
     is_dummy_for_shuffle = dummy_for_shuffle;
     id = -1;
     partent = NULL;
-    trueData = padZero(trueData);
+    trueData.clear();
     text = "";
 }
 
@@ -66,14 +67,8 @@ Branch::Branch(const Branch* other) {
     this->weight = other->weight;
     this->m_rect = other->m_rect;
 
-    // 2. 关键点：为 child_triple 创建全新的指针
-    this->child_triple.clear();
-    for (const auto* old_triple : other->child_triple) {
-        if (old_triple) {
-            // new 出一个新的 Triple 对象，保证地址完全独立
-            this->child_triple.push_back(new Triple(old_triple));
-        }
-    }
+    // 2. child_triple 内联存放，直接整体复制
+    this->child_triple = other->child_triple;
     // 注意：父节点和子节点的指针处理
     // 通常在复制单个节点时，我们不希望简单的复制指针地址（那还是指向同一个地方）
     // 这里的逻辑根据你的业务需求决定：
@@ -81,16 +76,14 @@ Branch::Branch(const Branch* other) {
     this->child_branch = other->child_branch; // 这里存的是指针，依然指向原来的子节点
 
     // 【新增修改】关键点：复制子节点的摘要信息
-    // 这两个 vector 存储的是对象（Rectangle）和数据（vector<double>），
+    // 这两个 vector 存储的是对象（Rectangle）和数据（SparseWeight），
     // 这里的直接赋值会自动执行深拷贝，不需要写循环。
     this->child_rects = other->child_rects; 
     this->child_weights_vec = other->child_weights_vec;
+    this->child_norms_vec = other->child_norms_vec;
 }
 
 Branch::~Branch() {
-    for (auto* t : child_triple) {
-        if (t) delete t;
-    }
     child_triple.clear();
     
     child_branch.clear(); 
@@ -137,52 +130,68 @@ double Branch::similarity(const string& s1, const string& s2) {
     return 1.0 - static_cast<double>(distance) / max((int)max(s1.length(), s2.length()), 1);
 }
 
-void Branch::CalcuKeyWordRele(string& text, vector<string> dic_str) {
+void Branch::CalcuKeyWordRele(string& text, const vector<string>& dic_str) {
     this->text = text;
-    if (weight.size() != dic_str.size()) {
-        weight.resize(dic_str.size(), 0.0);
-    }
+    this->weight.clear();
     for (int i = 0; i < dic_str.size(); i++) {
-        this->weight[i] = similarity(text, dic_str[i]);
+        double s = similarity(text, dic_str[i]);
+        if (s != 0.0) this->weight.push_back({i, s});
     }
 }
 
-void Branch::CalcuKeyWordWeight(string &text, vector<string> dic_str) {
-    // 简单的 TF 计算
-    int dic_num = int(dic_str.size());
-    vector<double> w(dic_num, 0);
+void Branch::CalcuKeyWordWeight(string &text, const vector<string>& dic_str) {
+    // 简单的 TF 计算：先统计文本中每个词的出现次数，再按字典顺序只保留非零项
+    unordered_map<string, int> token_count;
     istringstream input(text);
     string temp;
-    vector<string> tempstr;
-    while(input >> temp) tempstr.push_back(temp);
+    while(input >> temp) {
+        LowerText(temp);
+        token_count[temp]++;
+    }
+
+    this->weight.clear();
+    if (token_count.empty()) return;
 
-    int i = 0;
     double maxnum = 0;
-    for(string str1: dic_str) {
-        LowerText(str1);
-        for(string str2 : tempstr) {
-            LowerText(str2);
-            if(str1 == str2) {
-                w[i]++;
-            }
-        }
-        if(w[i] > maxnum) maxnum = w[i];
-        i++;
+    string term;
+    for(int i = 0; i < dic_str.size(); i++) {
+        term.assign(dic_str[i]);
+        LowerText(term);
+        auto it = token_count.find(term);
+        if (it == token_count.end()) continue;
+        this->weight.push_back({i, double(it->second)});
+        if(it->second > maxnum) maxnum = it->second;
     }
 
-    if (maxnum > 0) {
-        for(int j = 0; j < w.size(); j++) w[j] /= maxnum;
-    }
-    this->weight = w;
+    for(auto& tw : this->weight) tw.weight /= maxnum;
 }
 
 void Branch::keyWeightUpdate(Branch *nBranch) {
-    if (this->weight.size() < nBranch->weight.size()) {
-        this->weight.resize(nBranch->weight.size(), 0.0);
-    }
-    for(int index = 0; index < this->weight.size(); index++) {
-        this->weight[index] = max(this->weight[index], nBranch->weight[index]);
+    // 两个按 term 有序的稀疏向量归并，重叠项取最大值
+    const SparseWeight& a = this->weight;
+    const SparseWeight& b = nBranch->weight;
+    SparseWeight merged;
+    merged.reserve(a.size() + b.size());
+    size_t i = 0, j = 0;
+    while (i < a.size() && j < b.size()) {
+        if (a[i].term < b[j].term) {
+            merged.push_back(a[i++]);
+        } else if (b[j].term < a[i].term) {
+            merged.push_back(b[j++]);
+        } else {
+            merged.push_back({a[i].term, max(a[i].weight, b[j].weight)});
+            i++; j++;
+        }
     }
+    merged.insert(merged.end(), a.begin() + i, a.end());
+    merged.insert(merged.end(), b.begin() + j, b.end());
+    this->weight.swap(merged);
+}
+
+void Branch::childSummaryUpdate(Branch *child) {
+    this->child_rects.push_back(child->m_rect);
+    this->child_weights_vec.push_back(child->weight);
+    this->child_norms_vec.push_back(WeightNorm(child->weight));
 }
 
 void Branch::rectUpdate(Rectangle *nRect) {
@@ -194,4 +203,39 @@ void Branch::rectUpdate(Rectangle *nRect) {
 
 bool Branch::operator==(const Branch& other) const {
     return id == other.id;
-}
\ No newline at end of file
+}
+
+BranchSlab::~BranchSlab() {
+    for (size_t s = 0; s < slabs_.size(); s++) {
+        size_t used = (s + 1 == slabs_.size()) ? next_in_slab_ : kSlotsPerSlab;
+        for (size_t i = 0; i < used; i++) {
+            Slot& slot = slabs_[s][i];
+            if (slot.live) reinterpret_cast<Branch*>(slot.storage)->~Branch();
+        }
+        alloc_.deallocate(slabs_[s], kSlotsPerSlab);
+    }
+}
+
+BranchSlab::Slot* BranchSlab::Allocate() {
+    std::lock_guard<std::mutex> lg(mtx_);
+    if (!free_list_.empty()) {
+        Slot* slot = free_list_.back();
+        free_list_.pop_back();
+        return slot;
+    }
+    if (next_in_slab_ == kSlotsPerSlab) {
+        slabs_.push_back(alloc_.allocate(kSlotsPerSlab));
+        next_in_slab_ = 0;
+    }
+    Slot* slot = slabs_.back() + next_in_slab_++;
+    slot->live = false;
+    return slot;
+}
+
+void BranchSlab::Delete(Branch* branch) {
+    Slot* slot = reinterpret_cast<Slot*>(branch);
+    branch->~Branch();
+    slot->live = false;
+    std::lock_guard<std::mutex> lg(mtx_);
+    free_list_.push_back(slot);
+}
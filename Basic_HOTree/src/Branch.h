@@ -1,5 +1,7 @@
 #pragma once
 #include "define.h"
+#include <memory>
+#include <mutex>
 
 struct Triple {
     int id;
@@ -7,6 +9,7 @@ struct Triple {
     int counter_for_lastest_data;
     
     // 构造函数
+    Triple() : id(0), level(0), counter_for_lastest_data(0) {}
     Triple(int a, int b, int c) : id(a), level(b), counter_for_lastest_data(c) {}
     
     Triple(const Triple* other) {
@@ -26,6 +29,43 @@ struct Triple {
 
 
 
+// 稀疏关键词权重：只保存非零项 (term 为字典下标)，按 term 升序排列
+struct TermWeight {
+    int term;
+    double weight;
+};
+using SparseWeight = std::vector<TermWeight>;
+
+// 稀疏权重向量的 L2 范数
+inline double WeightNorm(const SparseWeight& w) {
+    double sum = 0;
+    for (const auto& tw : w) sum += tw.weight * tw.weight;
+    return sqrt(sum);
+}
+
+// 容量固定为 N 的内联数组：元素直接存放在节点内，不做堆分配，也没有逐元素的指针间接
+template <typename T, size_t N>
+class InlineArray {
+public:
+    void push_back(const T& value) {
+        if (size_ == N) throw std::length_error("InlineArray is full");
+        items_[size_++] = value;
+    }
+    void clear() { size_ = 0; }
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    T& operator[](size_t i) { return items_[i]; }
+    const T& operator[](size_t i) const { return items_[i]; }
+    T* begin() { return items_; }
+    T* end() { return items_ + size_; }
+    const T* begin() const { return items_; }
+    const T* end() const { return items_ + size_; }
+
+private:
+    T items_[N] = {};
+    size_t size_ = 0;
+};
+
 // --- Branch 结构 (参考 Branch.h) ---
 class Branch {
 public:
@@ -35,16 +75,19 @@ public:
 
     Rectangle m_rect;         // 保存矩形数据
     std::string text;         // 保存文本数据
-    std::vector<double> weight; 
-    std::string trueData;     // 真实数据
+    SparseWeight weight;      // 稀疏关键词权重 (叶子为 TF，中间节点为孩子的逐项最大值)
+    EncBlock trueData;        // 真实数据 (定长加密块，原地加解密)
     bool is_empty_data;       // 记录是否为空数据
     bool is_dummy_for_shuffle;// just for shuffle
     std::vector<Rectangle> child_rects; 
     // 存储子节点的关键词权重，用于父节点直接计算子节点的文本相关性
-    std::vector<std::vector<double>> child_weights_vec; 
+    std::vector<SparseWeight> child_weights_vec; 
+    // 孩子权重向量的范数，Build 时随摘要一起写入，打分时只需计算点积
+    std::vector<double> child_norms_vec;
 
-    std::vector<Triple*> child_triple;
-    std::vector<Branch*> child_branch;
+    // 孩子的 (id, level, counter) 记录与孩子指针都内联存放，查询持有的 Triple* 指向这里 (节点由 slab 分配，地址不变)
+    InlineArray<Triple, MAX_SIZE> child_triple;
+    InlineArray<Branch*, MAX_SIZE> child_branch;
     Branch* partent;
 
     Branch();
@@ -74,15 +117,51 @@ public:
         }
     }
     // 按照 Branch.h 定义，依赖全局 dic_str
-    void CalcuKeyWordRele(std::string& text, std::vector<std::string> dic_str);
-    void CalcuKeyWordWeight(std::string &text, std::vector<std::string> dic_str);
+    void CalcuKeyWordRele(std::string& text, const std::vector<std::string>& dic_str);
+    void CalcuKeyWordWeight(std::string &text, const std::vector<std::string>& dic_str);
 
     void keyWeightUpdate(Branch *nBranch);
+    void childSummaryUpdate(Branch *child); // 记录孩子的矩形、权重及其范数
     void rectUpdate(Rectangle *nRect);
     
     bool operator==(const Branch& other) const;
 };
 
+// Branch 对象的 slab 分配器：每块按 kSlabBytes 字节申请 (至少放得下一个对象)，Delete 后的槽位进入空闲表复用。
+// 每个槽位带一个存活标记，析构时只销毁仍存活的对象。New / Delete 加锁，可在 Build 的并行区域中调用
+class BranchSlab {
+public:
+    BranchSlab() = default;
+    BranchSlab(const BranchSlab&) = delete;
+    BranchSlab& operator=(const BranchSlab&) = delete;
+    ~BranchSlab();
+
+    template <typename... Args>
+    Branch* New(Args&&... args) {
+        Slot* slot = Allocate();
+        Branch* branch = new (slot->storage) Branch(std::forward<Args>(args)...);
+        slot->live = true;
+        return branch;
+    }
+    void Delete(Branch* branch);
+
+private:
+    // 对象放在槽位开头，Delete 可以直接由 Branch* 找回自己的槽位
+    struct Slot {
+        alignas(Branch) unsigned char storage[sizeof(Branch)];
+        bool live;
+    };
+    static constexpr size_t kSlabBytes = 1 << 20;
+    static constexpr size_t kSlotsPerSlab = std::max<size_t>(1, kSlabBytes / sizeof(Slot));
+    Slot* Allocate();
+
+    std::mutex mtx_;
+    std::allocator<Slot> alloc_;
+    std::vector<Slot*> slabs_;
+    std::vector<Slot*> free_list_;
+    size_t next_in_slab_ = kSlotsPerSlab; // 最后一块中下一个未使用的槽位
+};
+
 // --- SearchItem (辅助结构) ---
 struct SearchItem {
     double score;
@@ -1,9 +1,79 @@
 #include "OHT.h"
-#include <random>
+#include "oblivious.h"
 #include <algorithm>
 #include <iostream>
 #include <cmath>
 
+namespace {
+// 最大层去重的排序项：key 高 32 位是 id，低 32 位是按位取反的 counter (同 id 时最新版本在前)
+struct VersionKey {
+    uint64_t key;
+    Branch* branch;
+};
+
+// bin 内 BFS 的临时数组，每个线程一份；seen 用轮次戳区分，免去每次清零
+struct BinScratch {
+    std::vector<long> parent;
+    std::vector<uint32_t> seen;
+    std::vector<long> queue;
+    uint32_t stamp = 0;
+
+    void reset() {
+        if (parent.size() != (size_t)Z) {
+            parent.assign(Z, -1);
+            seen.assign(Z, 0);
+            queue.reserve(Z);
+        }
+        if (++stamp == 0) {
+            std::fill(seen.begin(), seen.end(), 0);
+            stamp = 1;
+        }
+        queue.clear();
+    }
+};
+
+// 在 [base, base + Z) 内从 p1/p2 出发 BFS 找最近的空槽，alt(slot) 给出该槽上元素的另一个位置。
+// 找到后沿路径把元素逐个挪到各自的另一个位置 (每次挪动回调 moved(from, to))，item 放进腾出的起点。
+// 返回 item 所在槽位的 bin 内下标；-1 表示两个位置所在的连通块已满
+template <typename AltFn, typename MoveFn>
+long bin_place(std::vector<CuckooTable::Entry>& table, size_t base, Branch* item, size_t p1, size_t p2,
+               BinScratch& s, AltFn&& alt, MoveFn&& moved) {
+    s.reset();
+    for (size_t p : {p1, p2}) {
+        long local = p - base;
+        if (s.seen[local] == s.stamp) continue;
+        s.seen[local] = s.stamp;
+        s.parent[local] = -1;
+        s.queue.push_back(local);
+    }
+
+    long hole = -1;
+    for (size_t head = 0; head < s.queue.size(); ++head) {
+        long cur = s.queue[head];
+        if (!table[base + cur].occupied) {
+            hole = cur;
+            break;
+        }
+        long next = alt(base + cur) - base;
+        if (s.seen[next] != s.stamp) {
+            s.seen[next] = s.stamp;
+            s.parent[next] = cur;
+            s.queue.push_back(next);
+        }
+    }
+    if (hole < 0) return -1;
+
+    long to = hole;
+    for (; s.parent[to] != -1; to = s.parent[to]) {
+        table[base + to] = table[base + s.parent[to]];
+        moved(base + s.parent[to], base + to);
+    }
+    table[base + to].branch = item;
+    table[base + to].occupied = true;
+    return to;
+}
+} // namespace
+
 CuckooTable::CuckooTable(size_t initial_size, int HOTREE_level) : current_count(0) {
     HOTREE_level_ = HOTREE_level;
     shuffle_count = 0;
@@ -27,12 +97,24 @@ size_t CuckooTable::hash(uint64_t id, size_t seed) const {
     return h % table.size();
 }
 
-std::vector<Branch*> CuckooTable::find_hotree(uint64_t id, size_t place1, size_t place2) {
-    std::vector<Branch*> result;
+std::array<Branch*, 2> CuckooTable::find_hotree(uint64_t id, size_t place1, size_t place2) {
     // 直接返回存储在 table 中的指针
-    result.push_back(table[place1].branch);
-    result.push_back(table[place2].branch);
-    return result;
+    return {table[place1].branch, table[place2].branch};
+}
+
+Branch* CuckooTable::take_hotree(uint64_t id, int counter_for_lastest_data, size_t place1, size_t place2) {
+    for (size_t place : {place1, place2}) {
+        Entry& entry = table[place];
+        // id 参数与 find_hotree / find 一样是 uint64_t，节点上的 int id 按同样的方式换算后再比较 (中间节点的负 id 也一致)
+        if (entry.occupied && entry.branch != nullptr && static_cast<uint64_t>(entry.branch->id) == id && entry.branch->counter_for_lastest_data == counter_for_lastest_data) {
+            Branch* result = entry.branch;
+            entry.branch = nullptr;
+            entry.occupied = false;
+            current_count--;
+            return result;
+        }
+    }
+    return nullptr;
 }
 
 Branch* CuckooTable::find(uint64_t id, uint64_t counter_for_lastest_data, Client* client) {
@@ -69,37 +151,21 @@ void CuckooTable::insert_internal(Branch* item, Client* client) {
         return; 
     }
 
-    static std::mt19937 rng(global_seed);
-    for (int i = 0; i < MAX_KICKS; ++i) {
-        uint64_t id_and_counter = combine_unique(item->id, item->counter_for_lastest_data);
-        
-        // 修改：使用统一的函数获取 Bin 内的两个位置
-        auto [p1, p2] = get_p1_p2(id_and_counter, client);
-
-        if (!table[p1].occupied) {
-            table[p1].branch = item;
-            table[p1].occupied = true;
-            current_count++;
-            return;
-        }
-
-        if (!table[p2].occupied) {
-            table[p2].branch = item;
-            table[p2].occupied = true;
-            current_count++;
-            return;
-        }
-
-        // 随机踢出一个指针 (此时踢出只会在该 Bin 内部的 p1 和 p2 之间发生)
-        bool kick_p1 = (rng() % 2) == 0;
-        size_t victim_pos = kick_p1 ? p1 : p2;
-        std::swap(item, table[victim_pos].branch);
+    // 修改：用 bin 内 BFS 找最短踢出路径代替随机踢出，占用者的另一个位置现算哈希得到
+    auto [p1, p2] = get_p1_p2(combine_unique(item->id, item->counter_for_lastest_data), client);
+    static thread_local BinScratch scratch;
+    auto alt = [&](size_t slot) {
+        Branch* occupant = table[slot].branch;
+        auto [q1, q2] = get_p1_p2(combine_unique(occupant->id, occupant->counter_for_lastest_data), client);
+        return slot == q1 ? q2 : q1;
+    };
+    if (bin_place(table, p1 / Z * Z, item, p1, p2, scratch, alt, [](size_t, size_t) {}) >= 0) {
+        current_count++;
+        return;
     }
     
-    // 如果达到了 MAX_KICKS 还没插入成功，放入全局 stash
+    // bin 内该连通块已满，放入全局 stash
     if(if_is_debug) {
-        uint64_t debug_id_counter = combine_unique(item->id, item->counter_for_lastest_data);
-        auto [p1, p2] = get_p1_p2(debug_id_counter, client);
         if(table[p1].branch!=nullptr && table[p1].branch->id == debug_id) {
             std::cout<<"In insert id "<< table[p1].branch->id <<" level "<<HOTREE_level_ <<" p1: "<<p1 << " seed: "<<client->vec_seed1_[HOTREE_level_]<<" table size"<< table.size()<< " counter "<< table[p1].branch->counter_for_lastest_data<<std::endl;    
         }
@@ -121,57 +187,148 @@ void CuckooTable::insert_internal(Branch* item, Client* client) {
     insert_internal(item, client);
 }
 
-void CuckooTable::rehash(size_t new_size, Client* client) {
-    std::vector<Entry> old_table = std::move(table);
-    std::vector<Branch*> old_stash = std::move(stash);
+void CuckooTable::build_from(const std::vector<Branch*>& items, Client* client) {
+    const size_t num_bins = table.size() / Z;
 
-    table.assign(new_size, Entry()); // 初始化新表
-    stash.clear();
-    current_count = 0;
-
-    for (const auto& entry : old_table) {
-        if (entry.occupied && entry.branch != nullptr) {
-            insert_internal(entry.branch, client);
+    // 1. 预先算好每个元素的两个位置，再按 bin 做稳定的计数排序 (构建结果与线程数无关)
+    std::vector<std::pair<size_t, size_t>> pos(items.size());
+    #pragma omp parallel for schedule(static) if(items.size() > (size_t)TEE_Z)
+    for (long i = 0; i < (long)items.size(); ++i) {
+        if (items[i] != nullptr) {
+            pos[i] = get_p1_p2(combine_unique(items[i]->id, items[i]->counter_for_lastest_data), client);
         }
     }
+    std::vector<size_t> bin_begin(num_bins + 1, 0);
+    for (size_t i = 0; i < items.size(); ++i) {
+        if (items[i] != nullptr) bin_begin[pos[i].first / Z + 1]++;
+    }
+    for (size_t b = 0; b < num_bins; ++b) bin_begin[b + 1] += bin_begin[b];
+    std::vector<size_t> order(bin_begin[num_bins]);
+    std::vector<size_t> fill(bin_begin.begin(), bin_begin.end() - 1);
+    for (size_t i = 0; i < items.size(); ++i) {
+        if (items[i] != nullptr) order[fill[pos[i].first / Z]++] = i;
+    }
 
-    for (auto* item : old_stash) {
-        if (item != nullptr) {
-            insert_internal(item, client);
+    // 2. 各 bin 的槽位互不相交，逐 bin 并行构建；other[k] 记录 bin 内第 k 个槽位上元素的另一个位置
+    std::vector<std::vector<Branch*>> overflow(num_bins);
+    size_t placed = 0;
+    #pragma omp parallel for schedule(dynamic) reduction(+:placed) if(num_bins > 1)
+    for (long b = 0; b < (long)num_bins; ++b) {
+        static thread_local BinScratch scratch;
+        static thread_local std::vector<size_t> other;
+        other.resize(Z);
+        const size_t base = b * Z;
+        auto same_version = [](const Branch* x, const Branch* y) {
+            return x != nullptr && x->id == y->id && x->counter_for_lastest_data == y->counter_for_lastest_data;
+        };
+        for (size_t k = bin_begin[b]; k < bin_begin[b + 1]; ++k) {
+            Branch* item = items[order[k]];
+            auto [p1, p2] = pos[order[k]];
+            // 同一版本只会落在自己的两个槽位或本 bin 的溢出表里
+            if (same_version(table[p1].branch, item) || same_version(table[p2].branch, item) ||
+                std::any_of(overflow[b].begin(), overflow[b].end(), [&](Branch* o) { return same_version(o, item); })) {
+                continue;
+            }
+            long root = bin_place(table, base, item, p1, p2, scratch,
+                [&](size_t slot) { return other[slot - base]; },
+                [&](size_t from, size_t to) { other[to - base] = from; });
+            if (root < 0) {
+                overflow[b].push_back(item);
+                continue;
+            }
+            other[root] = (base + root == p1) ? p2 : p1;
+            placed++;
+        }
+    }
+    current_count += placed;
+
+    // 3. 溢出元素按 bin 顺序进 stash；stash 也放不下时才整表扩容重建
+    bool stash_full = false;
+    for (auto& bin_overflow : overflow) {
+        for (Branch* item : bin_overflow) {
+            if (stash.size() >= STASH_CAPACITY) stash_full = true;
+            stash.push_back(item);
         }
     }
+    if (stash_full) {
+        rehash(table.size() * 2, client);
+    }
 }
 
-std::vector<Branch*> CuckooTable::oblivious_tight_compaction(std::vector<Branch*> all_elements1, std::vector<int> branchs_level_belong_to, Client* client) {
-    std::vector<Branch*> result_branchs;
-    std::unordered_map<int, Branch*> unique_elements;
-    for (auto& elem : all_elements1) {
-        if (elem == nullptr) continue;
+void CuckooTable::rehash(size_t new_size, Client* client) {
+    std::vector<Branch*> all_items = std::move(stash);
+    for (const auto& entry : table) {
+        if (entry.occupied && entry.branch != nullptr) all_items.push_back(entry.branch);
+    }
 
-        int id = elem->id;
-        // 如果 id 不存在，或者当前元素的 counter 更大，则更新/插入
-        if (unique_elements.find(id) == unique_elements.end() || 
-            elem->counter_for_lastest_data > unique_elements[id]->counter_for_lastest_data) {
-            unique_elements[id] = elem;
-        }
+    table.assign(new_size, Entry()); // 初始化新表
+    stash.clear();
+    current_count = 0;
+    build_from(all_items, client);
+}
+
+std::vector<Branch*> CuckooTable::oblivious_tight_compaction(const std::vector<Branch*>& all_elements1, const std::vector<int>& branchs_level_belong_to, Client* client) {
+    // 1. 抽出排序键：id 升序、counter 降序，同版本再按地址排，保证结果确定、同一指针相邻
+    std::vector<VersionKey> keys;
+    keys.reserve(all_elements1.size());
+    for (Branch* elem : all_elements1) {
+        if (elem == nullptr) continue;
+        keys.push_back({version_route(elem), elem});
+    }
+    const size_t n = keys.size();
+
+    // 2. 不经意排序 (bitonic，OpenMP task 并行)
+    oblivious::bitonic_sort_parallel(keys.data(), n, [](const VersionKey& a, const VersionKey& b) {
+        return (a.key < b.key) | ((a.key == b.key) & (a.branch < b.branch));
+    });
+
+    // 3. 每个 id 的第一项是最新版本：无分支地标记保留项；其余版本 (与保留项相同的指针除外) 标记为丢弃
+    std::vector<uint8_t> keep(n), drop(n);
+    Branch* winner = nullptr;
+    for (size_t i = 0; i < n; ++i) {
+        bool first = (i == 0) | ((keys[i].key >> 32) != (keys[std::max<size_t>(i, 1) - 1].key >> 32));
+        keep[i] = first;
+        winner = reinterpret_cast<Branch*>(oblivious::select(first, (size_t)keys[i].branch, (size_t)winner));
+        drop[i] = keys[i].branch != winner;
     }
-    for (auto const& [id, elem] : unique_elements) {
-        if (id == debug_id && if_is_debug) {
+
+    // 4. 丢弃项由第二次不经意压缩取出，交给 GC 释放
+    std::vector<VersionKey> dropped(keys);
+    size_t dropped_count = oblivious::compact_parallel(dropped.data(), drop.data(), n);
+    discarded.reserve(discarded.size() + dropped_count);
+    for (size_t i = 0; i < dropped_count; ++i) discarded.push_back(dropped[i].branch);
+
+    // 5. 不经意压缩：保留项稳定地移到前面
+    size_t unique_count = oblivious::compact_parallel(keys.data(), keep.data(), n);
+
+    std::vector<Branch*> result_branchs(unique_count);
+    #pragma omp parallel for schedule(static) if(unique_count > (size_t)TEE_Z)
+    for (long i = 0; i < (long)unique_count; ++i) {
+        Branch* elem = keys[i].branch;
+        if (elem->id == debug_id && if_is_debug) {
             printf("Inserting unique id %d with max counter %d in OHT.cpp\n", 
                 elem->id, elem->counter_for_lastest_data);
         }
         elem->level = HOTREE_level_;
         elem->counter_for_lastest_data = 0;
         for(auto & triple : elem->child_triple) {
-            triple->counter_for_lastest_data = 0;
-            triple->level = HOTREE_level_;
+            triple.counter_for_lastest_data = 0;
+            triple.level = HOTREE_level_;
         }
-        result_branchs.push_back(elem);
-        // all_elements.push_back(elem);
+        result_branchs[i] = elem;
     }
     return result_branchs;
 }
 
+void CuckooTable::reencrypt_to_level(const std::vector<Branch*>& elements, const std::vector<int>& branchs_level_belong_to, Client* client) {
+    #pragma omp parallel for schedule(static) if(elements.size() > (size_t)TEE_Z)
+    for (long i = 0; i < (long)elements.size(); ++i) {
+        if (branchs_level_belong_to[i] == HOTREE_level_) continue;
+        client->cryptor_->aes_decrypt_block(elements[i]->trueData, branchs_level_belong_to[i]);
+        client->cryptor_->aes_encrypt_block(elements[i]->trueData, HOTREE_level_);
+    }
+}
+
 void CuckooTable::oblivious_shuffle_and_insert(std::vector<Branch*>& all_elements_before_otc, std::vector<int> branchs_level_belong_to, Client* client) {
     // 1. 初始化基础状态
     table.assign(get_aligned_size(pow(2, HOTREE_level_)), Entry());
@@ -184,17 +341,18 @@ void CuckooTable::oblivious_shuffle_and_insert(std::vector<Branch*>& all_element
     if(all_elements_before_otc.size() <= TEE_Z) {
         // ... (保持原始代码中的特殊处理逻辑) ...
         // 为节省篇幅，此处省略未变动的小规模数据处理代码
+        reencrypt_to_level(all_elements_before_otc, branchs_level_belong_to, client);
         if(HOTREE_level_ != client->max_level_) {
             client->communication_round_trip_ += all_elements_before_otc.size()/TEE_Z;
             client->communication_volume_ += all_elements_before_otc.size()*BlockSize;
-            for(auto &elem : all_elements_before_otc) insert(elem, client);
+            build_from(all_elements_before_otc, client);
             // std::cout<<"level_i: "<<HOTREE_level_ <<" N_real:"<< all_elements_before_otc.size()<<std::endl;
             return;
         } else {
             client->communication_round_trip_ += 2*all_elements_before_otc.size()/TEE_Z;
             client->communication_volume_ += 2*all_elements_before_otc.size()*BlockSize;
             all_elements = oblivious_tight_compaction(all_elements_before_otc, branchs_level_belong_to, client);
-            for(auto &elem : all_elements) insert(elem, client);
+            build_from(all_elements, client);
             return;
         }
     }
@@ -205,9 +363,10 @@ void CuckooTable::oblivious_shuffle_and_insert(std::vector<Branch*>& all_element
         client->communication_round_trip_ += single_shuffle_round_trips;
         client->communication_volume_ += single_shuffle_commucations;
         // 模拟模式下，仍需执行必要的 insert 以维持功能正确性，但跳过 Shuffle
+        reencrypt_to_level(all_elements_before_otc, branchs_level_belong_to, client);
         std::vector<Branch*>& target_elements = (HOTREE_level_ == client->max_level_) ? 
             (all_elements = oblivious_tight_compaction(all_elements_before_otc, branchs_level_belong_to, client)) : all_elements_before_otc;
-        for(auto &elem : target_elements) insert(elem, client);
+        build_from(target_elements, client);
         return;
     } else {
         shuffle_tested_flag = true;
@@ -248,40 +407,34 @@ void CuckooTable::oblivious_shuffle_and_insert(std::vector<Branch*>& all_element
     // omp_set_num_threads(num_threads);
     // #pragma omp parallel for schedule(static)
     for(int i = 0; i < (int)all_elements.size(); i++) {
-        all_elements[i]->trueData = client->cryptor_->aes_decrypt(all_elements[i]->trueData, branchs_level_belong_to[i]);
+        client->cryptor_->aes_decrypt_block(all_elements[i]->trueData, branchs_level_belong_to[i]);
     }
 
-    // 4. 【优化 1 & 3】Ping-Pong 双缓冲 + 连续内存池
+    // 4. 【优化 1 & 3】Ping-Pong 双缓冲
     // 只分配两层所需的指针空间，大幅降低内存占用 (Cache Friendly)
     std::vector<Branch*> buffer_curr(total_nodes_per_level, nullptr);
     std::vector<Branch*> buffer_next(total_nodes_per_level, nullptr);
-
-    // 【优化 3】使用 vector 连续存储 Branch 对象，避免大量 new 造成的堆碎片
-    int num_dummies = total_nodes_per_level - all_elements.size();
-    // 注意：如果有跨层逻辑依赖指针地址唯一性，这里使用 vector 存储对象是安全的
-    // 只要 vector 不发生 realloc (reserve 足够空间)
-    std::vector<Branch> dummy_arena; 
-    if (num_dummies > 0) {
-        dummy_arena.reserve(num_dummies + B * Z); // 额外预留一些空间防止扩容
-        // 构造所有需要的 dummy (注意：这里在单线程预先构造，避免 OMP 中竞争)
-        // 使用 assign 填充比 push_back 更快
-        dummy_arena.assign(num_dummies, Branch(true, true)); 
+    // 与指针平行的路由哈希 (hash % B，dummy 槽位为 dummy_route)，随指针在双缓冲间搬运。
+    // 各趟只顺序读写这两组数组，不再为判断 dummy、计算路由回头访问分散在堆上的节点；
+    // dummy 也就不需要各自的对象 (原先每个 dummy 都是一个带 4KB 密文块的 Branch)
+    std::vector<size_t> route_curr(total_nodes_per_level, dummy_route);
+    std::vector<size_t> route_next(total_nodes_per_level, dummy_route);
+
+    // 路由哈希整批计算一次 (可向量化)，之后各趟只搬运
+    std::vector<uint64_t> route_keys(all_elements.size());
+    std::vector<size_t> routes(all_elements.size());
+    for (size_t i = 0; i < all_elements.size(); ++i) {
+        route_keys[i] = combine_unique(all_elements[i]->id, all_elements[i]->counter_for_lastest_data);
     }
+    client->compute_hash_batch(route_keys.data(), route_keys.size(), B, routes.data());
 
-    // 填充 Level 0 (初始化 buffer_curr)
+    // 填充 Level 0 (初始化 buffer_curr)：每个桶前半部分放真实数据，其余留作 dummy
     int data_idx = 0;
-    int dummy_idx = 0;
     for(int b = 0; b < B; ++b) {
         int base_offset = b * Z;
-        // 填充前半部分真实数据
-        int k = 0;
-        for(; k < Z/2 && data_idx < (int)all_elements.size(); ++k) {
-            buffer_curr[base_offset + k] = all_elements[data_idx++];
-        }
-        // 填充剩余部分为 Dummy
-        for(; k < Z; ++k) {
-            // 取出 dummy 对象的地址
-            buffer_curr[base_offset + k] = &dummy_arena[dummy_idx++];
+        for(int k = 0; k < Z/2 && data_idx < (int)all_elements.size(); ++k, ++data_idx) {
+            buffer_curr[base_offset + k] = all_elements[data_idx];
+            route_curr[base_offset + k] = routes[data_idx];
         }
     }
 
@@ -335,59 +488,43 @@ void CuckooTable::oblivious_shuffle_and_insert(std::vector<Branch*>& all_element
     //     // std::swap 对 vector 只是交换内部指针，开销为 O(1)
     //     std::swap(buffer_curr, buffer_next);
     // }
-    for (int i = 0; i < num_levels_shuffle; ++i) {
-        const int p2i = 1 << i;
-        const int p2i_mask = p2i - 1; 
-
-        // 改为按 num_users 步进
-        for (int j_start = 0; j_start < B / 2; j_start += num_users) {
-            // 计算当前批次实际数量 (处理尾部不够 20 的情况)
-            int current_batch = std::min(num_users, (B / 2) - j_start);
-            
-            // 准备 Batch 容器
-            std::vector<std::vector<Branch*>> batch_in_0(current_batch);
-            std::vector<std::vector<Branch*>> batch_in_1(current_batch);
-            std::vector<std::vector<Branch*>> batch_out_0, batch_out_1;
-            
-            // 1. 组装输入 Batch (完全在内存连续区域操作)
-            for (int k = 0; k < current_batch; ++k) {
-                int j = j_start + k;
-                int b1 = (j & p2i_mask) + ((j >> i) << (i + 1));
-                int b2 = b1 + p2i;
-                
-                auto start_b1 = buffer_curr.begin() + b1 * Z;
-                batch_in_0[k] = std::vector<Branch*>(start_b1, start_b1 + Z);
-                
-                auto start_b2 = buffer_curr.begin() + b2 * Z;
-                batch_in_1[k] = std::vector<Branch*>(start_b2, start_b2 + Z);
-            }
-
-            // 2. 批处理调用 (20 个用户并发执行)
-            bool is_first_level = (i == 0);
-            client->ObliviousMergeSplit_Batched(
-                batch_in_0, batch_in_1, 
-                batch_out_0, batch_out_1, 
-                i, num_levels_shuffle, HOTREE_level_, is_first_level
-            );
-
-            // 3. 将结果写回双缓冲的 Next 阶段
-            for (int k = 0; k < current_batch; ++k) {
-                int j = j_start + k;
-                int dest_idx_1 = (2 * j) * Z;
-                int dest_idx_2 = (2 * j + 1) * Z;
-                
-                std::copy(batch_out_0[k].begin(), batch_out_0[k].end(), buffer_next.begin() + dest_idx_1);
-                std::copy(batch_out_1[k].begin(), batch_out_1[k].end(), buffer_next.begin() + dest_idx_2);
+    // 每趟把 2^k 个桶合成一组、按哈希的 k 位一次路由，趟数从 log2(B) 降到 ceil(log2(B) / k)。
+    // 第 i 层起的一趟：输入组为位置 [high | m | low] (m 占 i..i+k-1 位)，输出写到 ((high << i | low) << k) + r，
+    // 与连续做 k 层 2 路 merge-split 的落点一致，最终桶号仍是 hash % B
+    std::vector<BucketSpan> batch_in(B), batch_out(B);
+    for (int i = 0; i < num_levels_shuffle; ) {
+        const int k = std::min(shuffle_radix_bits, num_levels_shuffle - i);
+        const int ways = 1 << k;
+        const int low_mask = (1 << i) - 1;
+        const int num_groups = B / ways;
+
+        // 1. 组装输入输出视图 (只记录桶在双缓冲中的位置，不拷贝指针)
+        for (int g = 0; g < num_groups; ++g) {
+            int low = g & low_mask;
+            int high = g >> i;
+            for (int m = 0; m < ways; ++m) {
+                int src = (high << (i + k)) | (m << i) | low;
+                size_t dst = (size_t)g * ways + m;
+                batch_in[dst] = {buffer_curr.data() + (size_t)src * Z, route_curr.data() + (size_t)src * Z, Z};
+                batch_out[dst] = {buffer_next.data() + dst * Z, route_next.data() + dst * Z, Z};
             }
         }
 
-        // 统计更新 (注意轮次统计的变化：每次发送一个 Batch 算一轮交互)
-        // 如果是严格模拟网络，20 个用户并发发送算 1 个通信回合
-        client->communication_round_trip_ += ceil((double)(B / 2) / num_users);
+        // 2. 一趟处理所有组，结果直接写入 buffer_next
+        client->ObliviousMergeSplit_Batched(
+            batch_in, batch_out, ways, num_levels_shuffle - i - k,
+            HOTREE_level_, i == 0
+        );
+
+        // 统计更新：一个批次 (每次交互) 仍装 2·TEE_Z 个块，即 2·num_users / ways 组
+        int groups_per_batch = std::max(1, 2 * num_users / ways);
+        client->communication_round_trip_ += ceil((double)num_groups / groups_per_batch);
         client->communication_volume_ += (B / 2) * 2 * Z * BlockSize * 2; 
 
-        // 交换 Buffer，准备下一层
+        // 交换 Buffer，准备下一趟
         std::swap(buffer_curr, buffer_next);
+        std::swap(route_curr, route_next);
+        i += k;
     }
 
     // 6. 记录纯 Shuffle 开销 (不含 insert)
@@ -406,11 +543,9 @@ void CuckooTable::oblivious_shuffle_and_insert(std::vector<Branch*>& all_element
 
     /*The oblivious shuffle has already clustered all data belonging to the same bin together. 
     Therefore, the client can retrieve Z data items at a time and insert each item to cuckoo hash table. 
-    For the local implementation of the cuckoo hash eviction operation, we insert elements one by one. 
-    This approach simplifies the implementation because there is no need to initialize multiple cuckoo hash tables. 
-    However, note that our implementation still guarantees the properties described in the paper, since during each insertion, 
-    the result of our hash computation is guaranteed to fall within a specific bin (see function get_p1_p2(uint64_t id_and_counter, Client* client)). 
-    Thus, we ensure that every element completes its eviction process within its assigned bin.*/
+    Both candidate positions of an element fall within one bin (see function get_p1_p2(uint64_t id_and_counter, Client* client)), 
+    so every element completes its eviction process within its assigned bin and the bins are independent cuckoo sub-tables. 
+    build_from() constructs these sub-tables in parallel, writing each bin directly into its slice of the table.*/
     // // 模拟不经意排序的时间开销：每 512 个数据等待 2ms
     // size_t batch_size = 512;
     // size_t num_batches = (buffer_curr.size() + batch_size - 1) / batch_size;  // 向上取整
@@ -424,17 +559,29 @@ void CuckooTable::oblivious_shuffle_and_insert(std::vector<Branch*>& all_element
     //     asm volatile("" ::: "memory");
     // }
 
-    for(Branch* branch : buffer_curr) {
-        if(branch != nullptr && !branch->is_dummy_for_shuffle) {
-            insert(branch, client);
+    // 逐桶并行挑出真实元素，再交给 build_from 按 bin 并行建表 (直接写入 table)
+    std::vector<size_t> bucket_real(B + 1, 0);
+    #pragma omp parallel for schedule(static) if(B > 1)
+    for (int b = 0; b < B; ++b) {
+        for (int k = 0; k < Z; ++k) {
+            if (route_curr[b * Z + k] != dummy_route) bucket_real[b + 1]++;
+        }
+    }
+    for (int b = 0; b < B; ++b) bucket_real[b + 1] += bucket_real[b];
+    std::vector<Branch*> real_elements(bucket_real[B]);
+    #pragma omp parallel for schedule(static) if(B > 1)
+    for (int b = 0; b < B; ++b) {
+        size_t out = bucket_real[b];
+        for (int k = 0; k < Z; ++k) {
+            if (route_curr[b * Z + k] != dummy_route) real_elements[out++] = buffer_curr[b * Z + k];
         }
     }
+    build_from(real_elements, client);
     client->communication_round_trip_ += buffer_curr.size() / Z;
     client->communication_volume_ += buffer_curr.size() * B; 
     
     // 8. 资源清理
-    // dummy_arena 会在函数结束时自动析构，无需手动 delete
-    // buffer vectors 也会自动释放
+    // buffer / route vectors 会自动释放
 }
 
 void CuckooTable::oblivious_shuffle_and_insert_last_level(std::vector<Branch*>& all_elements, std::vector<int> branchs_level_belong_to, Client* client) {
@@ -448,127 +595,101 @@ void CuckooTable::oblivious_shuffle_and_insert_last_level(std::vector<Branch*>&
     // omp_set_num_threads(num_threads);
     // #pragma omp parallel for schedule(static)
     for(int i = 0; i < (int)all_elements.size(); i++) {
-        all_elements[i]->trueData = client->cryptor_->aes_decrypt(all_elements[i]->trueData, branchs_level_belong_to[i]);
+        client->cryptor_->aes_decrypt_block(all_elements[i]->trueData, branchs_level_belong_to[i]);
     }
 
-    // 3. 【优化】内存初始化 (NUMA 优化 + 内存池)
-    // 使用双缓冲 Ping-Pong 结构，替代昂贵的 memory[levels] 结构
-    std::vector<Branch*> buffer_curr(total_nodes_per_level);
-    std::vector<Branch*> buffer_next(total_nodes_per_level);
-
-    // 使用 parallel for 初始化以触发 NUMA 的 First-Touch 策略
-    // #pragma omp parallel for schedule(static)
-    for(int i = 0; i < total_nodes_per_level; ++i) {
-        buffer_curr[i] = nullptr;
-        buffer_next[i] = nullptr;
-    }
-
-    // 【优化】Arena 方式分配 Dummy 对象
-    // 只需要分配填充第一层所需的 Dummy 即可，后续层级只是指针的置换
-    int num_dummies = total_nodes_per_level - N_real;
-    std::vector<Branch> dummy_arena;
-    if (num_dummies > 0) {
-        dummy_arena.reserve(num_dummies + B); // 预留少量 padding 防止溢出
-        dummy_arena.assign(num_dummies, Branch(true, true)); // 连续内存分配
-    }
+    // 3. 双缓冲 Ping-Pong 结构，替代昂贵的 memory[levels] 结构。
+    // 与指针平行的路由数组保存每个槽位的 version_route (dummy 为 dummy_route)，填充时算一次、之后随指针搬运：
+    // merge-split 与最后的收集只读这两组连续数组，dummy 槽位就是空指针，不再为每个 dummy 构造 Branch
+    std::vector<Branch*> buffer_curr(total_nodes_per_level, nullptr);
+    std::vector<Branch*> buffer_next(total_nodes_per_level, nullptr);
+    std::vector<size_t> route_curr(total_nodes_per_level, dummy_route);
+    std::vector<size_t> route_next(total_nodes_per_level, dummy_route);
 
-    // 4. 填充初始 Buffer (Level 0)
-    // 根据原逻辑：前 Z/2 个放真实数据，剩下的放 Dummy
+    // 4. 填充初始 Buffer (Level 0)：每个桶前 Z/2 个放真实数据 (按路由值排好序，之后每轮 merge-split 只需归并)，其余留作 dummy
     int real_idx = 0;
-    int dummy_idx = 0;
-
+    std::vector<std::pair<size_t, Branch*>> initial_bucket;
     for(int b = 0; b < B; ++b) {
         int base_offset = b * Z;
-        int k = 0;
-        
-        // 填充真实数据
-        for(; k < Z/2 && real_idx < N_real; ++k) {
-            buffer_curr[base_offset + k] = all_elements[real_idx++];
+        initial_bucket.clear();
+        for(int k = 0; k < Z/2 && real_idx < N_real; ++k, ++real_idx) {
+            initial_bucket.push_back({version_route(all_elements[real_idx]), all_elements[real_idx]});
         }
-        // 填充 Dummy 数据
-        for(; k < Z; ++k) {
-            buffer_curr[base_offset + k] = &dummy_arena[dummy_idx++];
+        std::sort(initial_bucket.begin(), initial_bucket.end());
+        for(size_t k = 0; k < initial_bucket.size(); ++k) {
+            buffer_curr[base_offset + k] = initial_bucket[k].second;
+            route_curr[base_offset + k] = initial_bucket[k].first;
         }
     }
 
-    // 5. 【优化】并行 Butterfly Network
-    for (int i = 0; i < num_levels_shuffle; ++i) {
-        const int p2i = 1 << i;
-        const int mask = p2i - 1; // 用于位运算替代取模
-
-        // #pragma omp parallel for schedule(static)
-        for (int j = 0; j < B / 2; ++j) {
-            // 【优化】位运算计算索引
-            int b1 = (j & mask) + ((j >> i) << (i + 1));
-            int b2 = b1 + p2i;
-
-            // 【优化】使用迭代器区间构造 Vector，利用底层 memcpy 加速
-            auto start_b1 = buffer_curr.begin() + b1 * Z;
-            std::vector<Branch*> bucket_i_b1(start_b1, start_b1 + Z);
-
-            auto start_b2 = buffer_curr.begin() + b2 * Z;
-            std::vector<Branch*> bucket_i_b2(start_b2, start_b2 + Z);
-
-            std::vector<Branch*> out_1(Z), out_2(Z);
-
-            // 调用 Last Level 特有的 Split 函数
-            // 原代码中 if(i==0) 和 else 调用的是同一个函数，这里直接统一调用
-            client->ObliviousMergeSplit_firstlevel_last_level(
-                bucket_i_b1, bucket_i_b2, out_1, out_2, 
-                i, num_levels_shuffle, HOTREE_level_
-            );
-
-            // 写回 buffer_next
-            int dest_idx_1 = (2 * j) * Z;
-            int dest_idx_2 = (2 * j + 1) * Z;
-
-            std::copy(out_1.begin(), out_1.end(), buffer_next.begin() + dest_idx_1);
-            std::copy(out_2.begin(), out_2.end(), buffer_next.begin() + dest_idx_2);
+    // 5. 分块调度的 Butterfly Network：从第 i 轮起的 k 轮只在同一组 2^k 个桶之间交换数据。
+    // 组内局部编号 l 的桶在 buffer_curr 中是 (high << (i + k)) | (l << i) | low，做完 k 轮后落到
+    // buffer_next 中连续的 ((high << i | low) << k) + l，局部网络与全局网络的前 k 轮结构相同。
+    // 中间各轮在组内的双缓冲上进行，整个缓冲区每 k 轮只被扫过一次；每个桶对的 merge-split 与逐轮调度相同，结果不变
+    const int block_ways = 1 << std::min(shuffle_block_rounds, num_levels_shuffle);
+    std::vector<Branch*> local_slots[2] = {std::vector<Branch*>((size_t)block_ways * Z), std::vector<Branch*>((size_t)block_ways * Z)};
+    std::vector<size_t> local_routes[2] = {std::vector<size_t>((size_t)block_ways * Z), std::vector<size_t>((size_t)block_ways * Z)};
+    auto local_span = [&](int side, size_t l) {
+        return BucketSpan{local_slots[side].data() + l * Z, local_routes[side].data() + l * Z, Z};
+    };
+    for (int i = 0; i < num_levels_shuffle; ) {
+        const int k = std::min(shuffle_block_rounds, num_levels_shuffle - i);
+        const int low_mask = (1 << i) - 1;
+        const int num_groups = B >> k;
+
+        for (int g = 0; g < num_groups; ++g) {
+            const size_t high = (size_t)(g >> i) << (i + k);
+            const size_t low = g & low_mask;
+            const size_t out_base = (size_t)g << k;
+            for (int r = 0; r < k; ++r) {
+                const int mask = (1 << r) - 1;
+                for (int j = 0; j < (1 << (k - 1)); ++j) {
+                    size_t b1 = (j & mask) + ((j >> r) << (r + 1));
+                    size_t b2 = b1 + ((size_t)1 << r);
+                    // 第一轮从 buffer_curr 按步长读入，最后一轮写到 buffer_next 的连续位置，其余在组内双缓冲间交替
+                    BucketSpan in_1 = (r == 0) ? BucketSpan{buffer_curr.data() + (high | (b1 << i) | low) * Z, route_curr.data() + (high | (b1 << i) | low) * Z, Z}
+                                               : local_span((r - 1) & 1, b1);
+                    BucketSpan in_2 = (r == 0) ? BucketSpan{buffer_curr.data() + (high | (b2 << i) | low) * Z, route_curr.data() + (high | (b2 << i) | low) * Z, Z}
+                                               : local_span((r - 1) & 1, b2);
+                    BucketSpan out_1 = (r == k - 1) ? BucketSpan{buffer_next.data() + (out_base + 2 * j) * Z, route_next.data() + (out_base + 2 * j) * Z, Z}
+                                                    : local_span(r & 1, 2 * j);
+                    BucketSpan out_2 = (r == k - 1) ? BucketSpan{buffer_next.data() + (out_base + 2 * j + 1) * Z, route_next.data() + (out_base + 2 * j + 1) * Z, Z}
+                                                    : local_span(r & 1, 2 * j + 1);
+                    client->ObliviousMergeSplit_firstlevel_last_level(in_1, in_2, out_1, out_2);
+                }
+            }
         }
 
-        // 更新统计 (移出并行区)
-        client->communication_round_trip_ += (B / 2) / num_threads;
-        client->communication_volume_ += (B / 2) * 2 * Z * BlockSize * 2; 
+        // 更新统计 (与逐轮调度相同：每轮 B / 2 对桶)
+        client->communication_round_trip_ += k * ((B / 2) / num_threads);
+        client->communication_volume_ += (double)k * (B / 2) * 2 * Z * BlockSize * 2;
 
-        // 交换 Buffer，准备下一轮
+        // 交换 Buffer，准备下一组轮次
         std::swap(buffer_curr, buffer_next);
+        std::swap(route_curr, route_next);
+        i += k;
     }
 
-    // 6. 最终插入与去重阶段
-    // 此时结果存储在 buffer_curr 中
+    // 6. 最终去重与插入阶段：此时结果存储在 buffer_curr 中
     table.assign(get_aligned_size(pow(2, HOTREE_level_)), Entry());
     stash.clear();
     current_count = 0;
     client->UpdateSeed(HOTREE_level_);
 
-    int curr_id = 2147483647; // Sentinel value
-
-
-    /*The oblivious shuffle has already clustered all data belonging to the same bin together. 
-    Therefore, the client can retrieve Z data items at a time and insert each item to cuckoo hash table. 
-    For the local implementation of the cuckoo hash eviction operation, we insert elements one by one. 
-    This approach simplifies the implementation because there is no need to initialize multiple cuckoo hash tables. 
-    However, note that our implementation still guarantees the properties described in the paper, since during each insertion, 
-    the result of our hash computation is guaranteed to fall within a specific bin (see function get_p1_p2(uint64_t id_and_counter, Client* client)). 
-    Thus, we ensure that every element completes its eviction process within its assigned bin.*/
-    for(Branch* branch : buffer_curr) {
-        if(branch != nullptr && !branch->is_dummy_for_shuffle) {
-            // 【保留】原有的去重逻辑
-            if(curr_id != branch->id) {
-                branch->level = HOTREE_level_;
-                branch->counter_for_lastest_data = 0;
-                
-                // 更新子节点元数据
-                for(auto & triple : branch->child_triple) {
-                    triple->counter_for_lastest_data = 0;
-                    triple->level = HOTREE_level_;
-                }
-                
-                insert(branch, client);
-                curr_id = branch->id;
-            }
-        }
+    // 按路由标记取出真实元素，去重与小规模合并共用同一套不经意排序 + 压缩 (每个 id 保留最新版本，其余进 discarded)
+    std::vector<Branch*> real_elements;
+    real_elements.reserve(N_real);
+    for(size_t slot = 0; slot < buffer_curr.size(); ++slot) {
+        if(route_curr[slot] != dummy_route) real_elements.push_back(buffer_curr[slot]);
     }
+    std::vector<Branch*> unique_elements = oblivious_tight_compaction(real_elements, branchs_level_belong_to, client);
+    // 网络中一直是明文，去重后用本层密钥加密一次 (被丢弃的旧版本随后释放，不必加密)
+    client->cryptor_->aes_encrypt_blocks(unique_elements.data(), unique_elements.size(), HOTREE_level_);
+
+    /*Each bin is an independent cuckoo sub-table: both candidate positions of an element fall within one bin
+    (see function get_p1_p2(uint64_t id_and_counter, Client* client)), so build_from() constructs the bins in parallel,
+    writing each bin directly into its slice of the table.*/
+    build_from(unique_elements, client);
     client->communication_round_trip_ += buffer_curr.size() / Z;
     client->communication_volume_ += buffer_curr.size() * B; 
 }
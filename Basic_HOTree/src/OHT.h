@@ -1,5 +1,6 @@
 #pragma once
 #include <vector>
+#include <array>
 #include <cstddef>
 #include <omp.h>
 #include <chrono>
@@ -14,7 +15,9 @@ public:
 
     // 修改：接收 Branch 指针，避免对象拷贝
     void insert(Branch* branch, Client* client);
-    std::vector<Branch*> find_hotree(uint64_t id, size_t place1, size_t place2);
+    std::array<Branch*, 2> find_hotree(uint64_t id, size_t place1, size_t place2);
+    // 读取两个位置，命中 (id, counter) 时把该块移出表 (槽位置空) 并返回，由调用方接管
+    Branch* take_hotree(uint64_t id, int counter_for_lastest_data, size_t place1, size_t place2);
     Branch* find(uint64_t id, uint64_t counter_for_lastest_data, Client* client);
     
     size_t size() const { return current_count + stash.size(); }
@@ -25,7 +28,10 @@ public:
     void oblivious_shuffle_and_insert_last_level(std::vector<Branch*>& all_elements, std::vector<int> branchs_level_belong_to, Client* client);
     // 修改：处理指针向量
     void oblivious_shuffle_and_insert(std::vector<Branch*>& all_elements, std::vector<int> branchs_level_belong_to, Client* client);
-    std::vector<Branch*> oblivious_tight_compaction(std::vector<Branch*> all_elements, std::vector<int> branchs_level_belong_to, Client* client);
+    // 最大层去重：按 (id, counter 降序) 不经意排序，标记每个 id 的最新版本后不经意压缩
+    std::vector<Branch*> oblivious_tight_compaction(const std::vector<Branch*>& all_elements, const std::vector<int>& branchs_level_belong_to, Client* client);
+    // 不经过 shuffle 直接建表时 (小规模或已测过 shuffle)，把来自其它层的元素从原层密钥换成本层密钥
+    void reencrypt_to_level(const std::vector<Branch*>& elements, const std::vector<int>& branchs_level_belong_to, Client* client);
 
 public:
     /*----------------------------------------for bucket hash--------------------------------------*/    
@@ -66,6 +72,7 @@ public:
 
     std::vector<Entry> table;
     std::vector<Branch*> stash; // 修改：存储指针
+    std::vector<Branch*> discarded; // 最大层合并去重时丢弃的旧版本 (可能有重复指针)，由 HOTree 释放
     const size_t STASH_CAPACITY = cuckoo_stash_size;
     size_t current_count;
     int HOTREE_level_;
@@ -75,11 +82,11 @@ public:
     int shuffle_count;
     bool shuffle_tested_flag = false;
 
-    static const int MAX_KICKS = 500;
-
     size_t hash(uint64_t id, size_t seed) const;
     void rehash(size_t new_size, Client* client);
     void insert_internal(Branch* branch, Client* client); // 修改：接收指针
+    // 把一整批元素按 bin 分组后逐 bin 并行构建 (调用前表需为空)，各 bin 内用 BFS 找最短踢出路径
+    void build_from(const std::vector<Branch*>& items, Client* client);
     void print_all_id() {
         for(auto & elem : table) {
             if(elem.branch != nullptr) {
@@ -110,7 +117,7 @@ public:
                 if (!b->child_triple.empty()) {
                     std::cout << "         └── Children: ";
                     for (size_t j = 0; j < b->child_triple.size(); ++j) {
-                        Triple* t = b->child_triple[j];
+                        const Triple* t = &b->child_triple[j];
                         if (t != nullptr) {
                             std::cout << "[ID:" << t->id << ", C:" << t->counter_for_lastest_data << ", L:" << t->level << "]";
                         } else {
@@ -136,8 +143,8 @@ public:
                     // 同样展开 Stash 节点的子节点
                     if (!sb->child_triple.empty()) {
                         std::cout << "           └── Children: ";
-                        for (auto* st : sb->child_triple) {
-                            if (st) std::cout << "[ID:" << st->id << ", C:" << st->counter_for_lastest_data << ", L:" << st->level << "] ";
+                        for (const auto& st : sb->child_triple) {
+                            std::cout << "[ID:" << st.id << ", C:" << st.counter_for_lastest_data << ", L:" << st.level << "] ";
                         }
                         std::cout << std::endl;
                     }
@@ -1,14 +1,155 @@
 #include "client.h"
+#include "oblivious.h"
+#include <atomic>
 #include <random>
+#if defined(__AVX512F__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+namespace {
+// 孩子打分每个 SIMD 通道负责一个孩子，通道内的累加顺序与标量版本一致，结果逐位相同
+#if defined(__AVX512F__)
+constexpr int kScoreLanes = 8;
+#elif defined(__AVX2__)
+constexpr int kScoreLanes = 4;
+#else
+constexpr int kScoreLanes = 1;
+#endif
+// 非零项已用完的通道指向它：乘积为 0，不影响累加结果
+const TermWeight kZeroTerm = {0, 0.0};
+
+// 标量版本 (编译时未启用 AVX2/AVX-512 时的回退)
+inline double score_child_scalar(const SparseWeight& w, double norm, const Rectangle& rect, const double* q,
+                                 double q_norm, const Rectangle& qrect) {
+    double rele = 0;
+    for (const auto& tw : w) {
+        rele += q[tw.term] * tw.weight;
+    }
+    double text = (q_norm == 0 || norm == 0) ? 0.0 : rele / (q_norm * norm);
+    double dist = rect.MinDist(qrect);
+    double spaceScore = 1.0 / (1.0 + dist);
+    return ALPHA * spaceScore + (1.0 - ALPHA) * text;
+}
+
+#if defined(__AVX512F__) || defined(__AVX2__)
+// 一组孩子的摘要指针：不足 kScoreLanes 个时用空摘要补齐，补齐通道的结果直接丢弃
+struct ChildLanes {
+    const SparseWeight* w[kScoreLanes];
+    const Rectangle* r[kScoreLanes];
+    double norm[kScoreLanes];
+    size_t max_nnz;
+
+    ChildLanes(const Branch* node, size_t first, size_t count) : max_nnz(0) {
+        static const SparseWeight empty_weight;
+        static const Rectangle empty_rect;
+        for (size_t c = 0; c < kScoreLanes; c++) {
+            w[c] = c < count ? &node->child_weights_vec[first + c] : &empty_weight;
+            r[c] = c < count ? &node->child_rects[first + c] : &empty_rect;
+            norm[c] = c < count ? node->child_norms_vec[first + c] : 0.0;
+            max_nnz = std::max(max_nnz, w[c]->size());
+        }
+    }
+    // 第 c 个通道的第 t 个非零项 (已用完的通道返回 kZeroTerm)
+    const TermWeight* term(size_t c, size_t t) const {
+        return t < w[c]->size() ? &(*w[c])[t] : &kZeroTerm;
+    }
+};
+#endif
+
+#if defined(__AVX512F__)
+inline void score_group_simd(const ChildLanes& lanes, const double* q, double q_norm,
+                             const Rectangle& qrect, double* out) {
+
+    __m512d dot = _mm512_setzero_pd();
+    for (size_t t = 0; t < lanes.max_nnz; t++) {
+        const TermWeight* e[kScoreLanes];
+        for (int c = 0; c < kScoreLanes; c++) e[c] = lanes.term(c, t);
+        __m512d wv = _mm512_set_pd(e[7]->weight, e[6]->weight, e[5]->weight, e[4]->weight,
+                                   e[3]->weight, e[2]->weight, e[1]->weight, e[0]->weight);
+        __m512d qv = _mm512_set_pd(q[e[7]->term], q[e[6]->term], q[e[5]->term], q[e[4]->term],
+                                   q[e[3]->term], q[e[2]->term], q[e[1]->term], q[e[0]->term]);
+        dot = _mm512_add_pd(dot, _mm512_mul_pd(qv, wv));
+    }
+
+    const __m512d zero = _mm512_setzero_pd();
+    const __m512d one = _mm512_set1_pd(1.0);
+    const Rectangle* const* r = lanes.r;
+    __m512d min_x = _mm512_set_pd(r[7]->min_Rec[0], r[6]->min_Rec[0], r[5]->min_Rec[0], r[4]->min_Rec[0],
+                                  r[3]->min_Rec[0], r[2]->min_Rec[0], r[1]->min_Rec[0], r[0]->min_Rec[0]);
+    __m512d max_x = _mm512_set_pd(r[7]->max_Rec[0], r[6]->max_Rec[0], r[5]->max_Rec[0], r[4]->max_Rec[0],
+                                  r[3]->max_Rec[0], r[2]->max_Rec[0], r[1]->max_Rec[0], r[0]->max_Rec[0]);
+    __m512d min_y = _mm512_set_pd(r[7]->min_Rec[1], r[6]->min_Rec[1], r[5]->min_Rec[1], r[4]->min_Rec[1],
+                                  r[3]->min_Rec[1], r[2]->min_Rec[1], r[1]->min_Rec[1], r[0]->min_Rec[1]);
+    __m512d max_y = _mm512_set_pd(r[7]->max_Rec[1], r[6]->max_Rec[1], r[5]->max_Rec[1], r[4]->max_Rec[1],
+                                  r[3]->max_Rec[1], r[2]->max_Rec[1], r[1]->max_Rec[1], r[0]->max_Rec[1]);
+    __m512d px = _mm512_set1_pd(qrect.min_Rec[0]), py = _mm512_set1_pd(qrect.min_Rec[1]);
+    // MinDist：点在矩形外时取到最近边的距离，否则为 0
+    __m512d dx = _mm512_max_pd(_mm512_max_pd(_mm512_sub_pd(min_x, px), _mm512_sub_pd(px, max_x)), zero);
+    __m512d dy = _mm512_max_pd(_mm512_max_pd(_mm512_sub_pd(min_y, py), _mm512_sub_pd(py, max_y)), zero);
+    __m512d dist = _mm512_sqrt_pd(_mm512_add_pd(_mm512_mul_pd(dx, dx), _mm512_mul_pd(dy, dy)));
+    __m512d space = _mm512_div_pd(one, _mm512_add_pd(one, dist));
+
+    __m512d norm = _mm512_loadu_pd(lanes.norm);
+    __m512d denom = _mm512_mul_pd(_mm512_set1_pd(q_norm), norm);
+    __mmask8 valid = _mm512_cmp_pd_mask(norm, zero, _CMP_NEQ_OQ);
+    if (q_norm == 0) valid = 0;
+    __m512d text = _mm512_mask_div_pd(zero, valid, dot, denom);
+
+    __m512d score = _mm512_add_pd(_mm512_mul_pd(_mm512_set1_pd(ALPHA), space),
+                                  _mm512_mul_pd(_mm512_set1_pd(1.0 - ALPHA), text));
+    _mm512_storeu_pd(out, score);
+}
+#elif defined(__AVX2__)
+inline void score_group_simd(const ChildLanes& lanes, const double* q, double q_norm,
+                             const Rectangle& qrect, double* out) {
+
+    __m256d dot = _mm256_setzero_pd();
+    for (size_t t = 0; t < lanes.max_nnz; t++) {
+        const TermWeight* e[kScoreLanes];
+        for (int c = 0; c < kScoreLanes; c++) e[c] = lanes.term(c, t);
+        __m256d wv = _mm256_set_pd(e[3]->weight, e[2]->weight, e[1]->weight, e[0]->weight);
+        __m256d qv = _mm256_set_pd(q[e[3]->term], q[e[2]->term], q[e[1]->term], q[e[0]->term]);
+        dot = _mm256_add_pd(dot, _mm256_mul_pd(qv, wv));
+    }
+
+    const __m256d zero = _mm256_setzero_pd();
+    const __m256d one = _mm256_set1_pd(1.0);
+    const Rectangle* const* r = lanes.r;
+    __m256d min_x = _mm256_set_pd(r[3]->min_Rec[0], r[2]->min_Rec[0], r[1]->min_Rec[0], r[0]->min_Rec[0]);
+    __m256d max_x = _mm256_set_pd(r[3]->max_Rec[0], r[2]->max_Rec[0], r[1]->max_Rec[0], r[0]->max_Rec[0]);
+    __m256d min_y = _mm256_set_pd(r[3]->min_Rec[1], r[2]->min_Rec[1], r[1]->min_Rec[1], r[0]->min_Rec[1]);
+    __m256d max_y = _mm256_set_pd(r[3]->max_Rec[1], r[2]->max_Rec[1], r[1]->max_Rec[1], r[0]->max_Rec[1]);
+    __m256d px = _mm256_set1_pd(qrect.min_Rec[0]), py = _mm256_set1_pd(qrect.min_Rec[1]);
+    // MinDist：点在矩形外时取到最近边的距离，否则为 0
+    __m256d dx = _mm256_max_pd(_mm256_max_pd(_mm256_sub_pd(min_x, px), _mm256_sub_pd(px, max_x)), zero);
+    __m256d dy = _mm256_max_pd(_mm256_max_pd(_mm256_sub_pd(min_y, py), _mm256_sub_pd(py, max_y)), zero);
+    __m256d dist = _mm256_sqrt_pd(_mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy)));
+    __m256d space = _mm256_div_pd(one, _mm256_add_pd(one, dist));
+
+    __m256d norm = _mm256_loadu_pd(lanes.norm);
+    __m256d denom = _mm256_mul_pd(_mm256_set1_pd(q_norm), norm);
+    __m256d valid = _mm256_cmp_pd(norm, zero, _CMP_NEQ_OQ);
+    if (q_norm == 0) valid = zero;
+    __m256d text = _mm256_and_pd(valid, _mm256_div_pd(dot, denom));
+
+    __m256d score = _mm256_add_pd(_mm256_mul_pd(_mm256_set1_pd(ALPHA), space),
+                                  _mm256_mul_pd(_mm256_set1_pd(1.0 - ALPHA), text));
+    _mm256_storeu_pd(out, score);
+}
+#endif
+}
 
 // Client::Client(int L): gen(rd()), dis(0, 0xFFFFFFFF) {
 Client::Client(int L): gen(global_seed), dis(0, 0xFFFFFFFF) {
     cryptor_ = new Cryptor(L);
     counter_access_ = 0;
     counter_self_healing_access_ = 0;
+    counter_retrieve_ = 0;
     communication_volume_ = 0;
     communication_round_trip_ = 0;
     stash_.reserve(Z); 
+    stash_index_.reserve(Z);
+    decrypt_scratch_ = std::make_unique<EncBlock>();
 
     // Ensure we have enough seeds. 
     // Note: For Cuckoo Table shuffle, we might need a specific seed. 
@@ -27,6 +168,33 @@ Client::Client(int L): gen(global_seed), dis(0, 0xFFFFFFFF) {
     vector_every_level_stash_.resize(L+1);
 }
 
+void Client::PushStash(Branch* branch) {
+    stash_index_[branch->id] = stash_.size();
+    stash_.push_back(branch);
+}
+
+void Client::ClearStash() {
+    stash_.clear();
+    stash_index_.clear();
+    stash_accesses_ = 0;
+}
+
+Branch* Client::FindInStash(int id, int counter) const {
+    if constexpr (oblivious_stash_scan) {
+        // 每个元素都读取并比较，用掩码而不是分支选出结果，耗时和访存序列与命中位置无关
+        uintptr_t result = 0;
+        for (Branch* current : stash_) {
+            uintptr_t mask = 0 - static_cast<uintptr_t>((current->id == id) & (current->counter_for_lastest_data == counter));
+            result = (result & ~mask) | (reinterpret_cast<uintptr_t>(current) & mask);
+        }
+        return reinterpret_cast<Branch*>(result);
+    }
+    auto it = stash_index_.find(id);
+    if (it == stash_index_.end()) return nullptr;
+    Branch* current = stash_[it->second];
+    return current->counter_for_lastest_data == counter ? current : nullptr;
+}
+
 void Client::UpdateSeed(size_t level_i) {
     seed_shuffle_ = dis(gen);
     vec_seed1_[level_i] = dis(gen);
@@ -39,7 +207,7 @@ Client::~Client() {
     cryptor_ = nullptr;
 
     // ✅ 正确做法：只清空容器，不删除指针 (因为 HOTree 会删)
-    stash_.clear();
+    ClearStash();
     for (auto& level_vec : vector_every_level_stash_) {
         level_vec.clear();
     }
@@ -60,16 +228,25 @@ int Client::get_first_empty_level() {
     }
 }
 
-double Client::CalcuTextRelevancy(std::vector<double> weight1, std::vector<double> weight2) {
+double Client::CalcuTextRelevancy(const SparseWeight& weight1, const SparseWeight& weight2) {
+    // 两个按 term 有序的稀疏向量做归并求点积，代价与非零项个数成正比
     double rele = 0;
     double sum1 = 0, sum2 = 0;
-    size_t n = std::min(weight1.size(), weight2.size());
-    for(size_t i = 0; i < n; i++) {
-        rele += weight1[i] * weight2[i];
-        sum1 += weight1[i] * weight1[i];
-        sum2 += weight2[i] * weight2[i];
-    }
+    for(const auto& tw : weight1) sum1 += tw.weight * tw.weight;
+    for(const auto& tw : weight2) sum2 += tw.weight * tw.weight;
     if (sum1 == 0 || sum2 == 0) return 0.0;
+
+    size_t i = 0, j = 0;
+    while(i < weight1.size() && j < weight2.size()) {
+        if(weight1[i].term < weight2[j].term) {
+            i++;
+        } else if(weight2[j].term < weight1[i].term) {
+            j++;
+        } else {
+            rele += weight1[i].weight * weight2[j].weight;
+            i++; j++;
+        }
+    }
     return rele / (sqrt(sum1) * sqrt(sum2));
 }
 
@@ -81,6 +258,39 @@ double Client::CalcuTestSPaceRele(Branch *n1, Branch *n2) {
     return rele;
 }
 
+void Client::BeginQuery(const Branch* query, size_t dic_size) {
+    if (query_dense_.size() < dic_size) query_dense_.resize(dic_size, 0.0);
+    for (const auto& tw : query->weight) {
+        query_dense_[tw.term] = tw.weight;
+    }
+    query_norm_ = WeightNorm(query->weight);
+}
+
+void Client::EndQuery(const Branch* query) {
+    // 只清零查询的非零项，下一次查询无需重新分配或整体清零
+    for (const auto& tw : query->weight) query_dense_[tw.term] = 0.0;
+    query_norm_ = 0;
+}
+
+void Client::CalcuChildrenRele(const Branch* node, const Branch* query, double* scores) const {
+    const size_t child_count = node->child_triple.size();
+    const double* q = query_dense_.data();
+    size_t c = 0;
+#if defined(__AVX512F__) || defined(__AVX2__)
+    for (; c < child_count; c += kScoreLanes) {
+        size_t count = std::min<size_t>(kScoreLanes, child_count - c);
+        alignas(64) double out[kScoreLanes];
+        score_group_simd(ChildLanes(node, c, count), q, query_norm_, query->m_rect, out);
+        std::copy(out, out + count, scores + c);
+    }
+#else
+    for (; c < child_count; c++) {
+        scores[c] = score_child_scalar(node->child_weights_vec[c], node->child_norms_vec[c], node->child_rects[c],
+                                       q, query_norm_, query->m_rect);
+    }
+#endif
+}
+
 size_t Client::compute_hash(uint64_t id, size_t mod_size) const {
     uint64_t k = id;
     const uint64_t m = 0xc6a4a7935bd1e995;
@@ -117,84 +327,147 @@ size_t Client::compute_hash2(uint64_t id, size_t level_i, size_t mod_size) const
 }
 
 
+namespace {
+// shuffle 路由时随指针一起搬运的槽位，route 为 dummy_route 表示 dummy
+struct RoutedSlot {
+    Branch* branch;
+    size_t route;
+};
+
+// 不经意地把 slots 中的 2^bits 个桶 (每桶 bucket_size 个槽) 按 route 的 bits 位 (最低位在 route_shift) 重新分桶：
+// 结果第 r 个桶装路由值为 r 的真实元素，其余是 dummy。逐位二分，每层给每段标记去前半段的真实元素，
+// 再按 dummy 出现的次序补标记到恰好半段，然后 ORCompact。没有依赖数据的分支与访存；某半段装不下时返回 false
+bool ObliviousRouteSplit(RoutedSlot* slots, int bits, int route_shift, size_t bucket_size) {
+    static thread_local std::vector<uint8_t> marks;
+    bool fits = true;
+    for (int l = 0; l < bits; ++l) {
+        const size_t seg = bucket_size << (bits - l);
+        const size_t half = seg / 2;
+        const int bit = route_shift + bits - 1 - l;
+        marks.resize(seg);
+        for (size_t s = 0; s < ((size_t)1 << l); ++s) {
+            RoutedSlot* d = slots + s * seg;
+            size_t reals = 0, to_front = 0;
+            for (size_t i = 0; i < seg; ++i) {
+                bool real = d[i].route != dummy_route;
+                reals += real;
+                to_front += real & !((d[i].route >> bit) & 1);
+            }
+            fits = fits & (to_front <= half) & (reals - to_front <= half);
+            const size_t pad = oblivious::select(to_front <= half, half - to_front, 0);
+            size_t dummies = 0;
+            for (size_t i = 0; i < seg; ++i) {
+                bool real = d[i].route != dummy_route;
+                marks[i] = (real & !((d[i].route >> bit) & 1)) | (!real & (dummies < pad));
+                dummies += !real;
+            }
+            oblivious::compact(d, marks.data(), seg);
+        }
+    }
+    return fits;
+}
+
+// 两路 merge-split 的路由：批量算出 pool 中真实元素的哈希，补 dummy 到 2Z 后不经意地分成两个 Z 大小的桶
+void RouteTwoWay(const Client& client, const std::vector<Branch*>& pool, int check_bit, size_t mod_size,
+                 Branch* dummy, std::vector<Branch*>& out_0, std::vector<Branch*>& out_1) {
+    if (pool.size() > 2 * (size_t)Z) throw std::overflow_error("oblivious shuffle: bucket overflow");
+    std::vector<uint64_t> keys(pool.size());
+    std::vector<size_t> routes(pool.size());
+    for (size_t i = 0; i < pool.size(); ++i) keys[i] = combine_unique(pool[i]->id, pool[i]->counter_for_lastest_data);
+    client.compute_hash_batch(keys.data(), keys.size(), mod_size, routes.data());
+
+    std::vector<RoutedSlot> slots(2 * Z, RoutedSlot{dummy, dummy_route});
+    for (size_t i = 0; i < pool.size(); ++i) slots[i] = {pool[i], routes[i]};
+    if (!ObliviousRouteSplit(slots.data(), 1, check_bit, Z)) {
+        throw std::overflow_error("oblivious shuffle: bucket overflow");
+    }
+    out_0.resize(Z);
+    out_1.resize(Z);
+    for (int i = 0; i < Z; ++i) {
+        out_0[i] = slots[i].branch;
+        out_1[i] = slots[Z + i].branch;
+    }
+}
+} // namespace
+
+void Client::compute_hash_batch(const uint64_t* ids, size_t n, size_t mod_size, size_t* out) const {
+    const uint64_t m = 0xc6a4a7935bd1e995;
+    const int r = 47;
+    const uint64_t h0 = seed_shuffle_ ^ (8 * m);
+    // 与 compute_hash 逐位相同；模数是 2 的幂 (shuffle 的桶数总是) 时用掩码代替取模，整段循环可以向量化
+    const bool pow2 = (mod_size & (mod_size - 1)) == 0;
+    const uint64_t mask = mod_size - 1;
+    #pragma omp simd
+    for (size_t i = 0; i < n; ++i) {
+        uint64_t k = ids[i];
+        k *= m; k ^= k >> r; k *= m;
+        uint64_t h = h0 ^ k;
+        h *= m;
+        h ^= h >> r; h *= m; h ^= h >> r;
+        out[i] = pow2 ? (h & mask) : (h % mod_size);
+    }
+}
+
 void Client::ObliviousMergeSplit_Batched(
-    const std::vector<std::vector<Branch*>>& batched_in_0,
-    const std::vector<std::vector<Branch*>>& batched_in_1,
-    std::vector<std::vector<Branch*>>& batched_out_0,
-    std::vector<std::vector<Branch*>>& batched_out_1,
-    int level_index,
-    int num_levels_shuffle,
+    const std::vector<BucketSpan>& batched_in,
+    const std::vector<BucketSpan>& batched_out,
+    int ways,
+    int route_shift,
     int HOTREE_level,
     bool is_first_level
 ) {
-    int current_batch = batched_in_0.size();
-    batched_out_0.resize(current_batch);
-    batched_out_1.resize(current_batch);
+    int num_buckets = batched_in.size();
+    int num_groups = num_buckets / ways;
 
     // 外层并行：分配给最高 20 个用户（线程）
-    // 每一个线程完整处理一对桶的解密、路由、加密，彻底消除嵌套并行的开销
     omp_set_num_threads(num_users); 
-    
-    #pragma omp parallel for schedule(static, 1)
-    for (int k = 0; k < current_batch; ++k) {
-        // 使用 static 避免频繁构造 Dummy，注意多线程下只读是安全的
-        static Branch dummy_branch(true, true);
-        std::vector<Branch*> pool;
-        pool.reserve(batched_in_0[k].size() + batched_in_1[k].size());
+    std::atomic<bool> overflowed(false);
 
-        // 1. 解密阶段 (非 first_level 需要解密)
+    // 1. 逐桶批量解密 (非 first_level 需要解密) + 重新加密，同一层密钥只展开一次；
+    //    各桶互不相关，按桶并行比按组并行粒度更细，ways 较大时也能用满线程
+    #pragma omp parallel for schedule(static, 1)
+    for (int b = 0; b < num_buckets; ++b) {
+        // 每个线程复用一份 pool，避免每个桶都重新分配
+        static thread_local std::vector<Branch*> pool;
+        pool.clear();
+        const BucketSpan& in = batched_in[b];
+        for (size_t t = 0; t < in.size; ++t) {
+            if (in.route[t] != dummy_route) pool.push_back(in[t]);
+        }
         if (!is_first_level) {
-            for(size_t i = 0; i < batched_in_0[k].size(); ++i) {
-                Branch* s = batched_in_0[k][i];
-                if (s != nullptr && !s->is_dummy_for_shuffle) {
-                    s->trueData = cryptor_->aes_decrypt(s->trueData, HOTREE_level);
-                }
-            }
-            for(size_t i = 0; i < batched_in_1[k].size(); ++i) {
-                Branch* s = batched_in_1[k][i];
-                if (s != nullptr && !s->is_dummy_for_shuffle) {
-                    s->trueData = cryptor_->aes_decrypt(s->trueData, HOTREE_level);
-                }
-            }
+            cryptor_->aes_decrypt_blocks(pool.data(), pool.size(), HOTREE_level);
         }
+        cryptor_->aes_encrypt_blocks(pool.data(), pool.size(), HOTREE_level);
+    }
 
-        // 2. 收集非 Dummy 元素
-        for(auto* s : batched_in_0[k]) {
-            if (s != nullptr && !s->is_dummy_for_shuffle) pool.push_back(s);
+    // 2. 逐组不经意路由：组内 ways 个输入桶拼成一段，按路由哈希的 k 位用 ORCompact 逐位二分后写回 ways 个输出桶。
+    //    只读写指针与路由数组，不访问节点本身，也没有依赖数据的分支
+    int bits = 0;
+    while ((1 << bits) < ways) bits++;
+    #pragma omp parallel for schedule(static, 1)
+    for (int g = 0; g < num_groups; ++g) {
+        const BucketSpan* in = batched_in.data() + (size_t)g * ways;
+        const BucketSpan* out = batched_out.data() + (size_t)g * ways;
+        const size_t bucket_size = in[0].size;
+        static thread_local std::vector<RoutedSlot> slots;
+        slots.resize(ways * bucket_size);
+
+        for (int m = 0; m < ways; ++m) {
+            for (size_t t = 0; t < bucket_size; ++t) {
+                slots[m * bucket_size + t] = {in[m][t], in[m].route[t]};
+            }
         }
-        for(auto* s : batched_in_1[k]) {
-            if (s != nullptr && !s->is_dummy_for_shuffle) pool.push_back(s);
+        if (!ObliviousRouteSplit(slots.data(), bits, route_shift, bucket_size)) {
+            overflowed = true; // 异常不能抛出并行区，出区后再报告
         }
-
-        std::vector<Branch*> real_elements_0;
-        std::vector<Branch*> real_elements_1;
-        real_elements_0.reserve(Z);
-        real_elements_1.reserve(Z);
-
-        // 3. 路由 & 加密 (单线程顺序执行，无需竞争，Cache 命中率极高)
-        int check_bit = num_levels_shuffle - 1 - level_index;
-        int mask = 1 << check_bit;
-        size_t mod_size = 1 << num_levels_shuffle;
-
-        for (auto* elem : pool) {
-            // 所有元素重新加密
-            elem->trueData = cryptor_->aes_encrypt(elem->trueData, HOTREE_level);
-            
-            // 计算路由
-            if (compute_hash(combine_unique(elem->id, elem->counter_for_lastest_data), mod_size) & mask) {
-                real_elements_1.push_back(elem);
-            } else {
-                real_elements_0.push_back(elem);
+        for (int r = 0; r < ways; ++r) {
+            for (size_t t = 0; t < bucket_size; ++t) {
+                out[r][t] = slots[r * bucket_size + t].branch;
+                out[r].route[t] = slots[r * bucket_size + t].route;
             }
         }
-
-        // 4. 补齐 Dummy 指针
-        while (real_elements_0.size() < Z) real_elements_0.push_back(&dummy_branch);
-        while (real_elements_1.size() < Z) real_elements_1.push_back(&dummy_branch);
-
-        batched_out_0[k] = std::move(real_elements_0);
-        batched_out_1[k] = std::move(real_elements_1);
     }
+    if (overflowed) throw std::overflow_error("oblivious shuffle: bucket overflow");
 }
 
 // src/client.cpp
@@ -215,33 +488,10 @@ void Client::ObliviousMergeSplit(
     pool.reserve(bucket_in_0.size() + bucket_in_1.size());
 
     // ============================================================
-    // 第一阶段：并行解密 (必须严格保护共享的 dummy 节点)
+    // 第一阶段：串行收集 (指针拷贝极快，无需并行，避免锁竞争)
     // ============================================================
+    // 只收集非 Dummy 元素，绝对不能对共享 Dummy 进行写操作！
     omp_set_num_threads(num_threads);
-
-    // 处理 bucket_in_0
-    #pragma omp parallel for
-    for(size_t i = 0; i < bucket_in_0.size(); ++i) {
-        Branch* s = bucket_in_0[i];
-        // 核心修复：先判断是否为空或 Dummy，绝对不能对共享 Dummy 进行写操作！
-        if (s != nullptr && !s->is_dummy_for_shuffle) {
-            s->trueData = cryptor_->aes_decrypt(s->trueData, HOTREE_level);
-        }
-    }
-
-    // 处理 bucket_in_1
-    #pragma omp parallel for
-    for(size_t i = 0; i < bucket_in_1.size(); ++i) {
-        Branch* s = bucket_in_1[i];
-        // 核心修复：同上
-        if (s != nullptr && !s->is_dummy_for_shuffle) {
-            s->trueData = cryptor_->aes_decrypt(s->trueData, HOTREE_level);
-        }
-    }
-
-    // ============================================================
-    // 第二阶段：串行收集 (指针拷贝极快，无需并行，避免锁竞争)
-    // ============================================================
     for(auto* s : bucket_in_0) {
         if (s != nullptr && !s->is_dummy_for_shuffle) {
             pool.push_back(s);
@@ -253,47 +503,18 @@ void Client::ObliviousMergeSplit(
         }
     }
     
-    // 准备输出容器
-    std::vector<Branch*> real_elements_0;
-    std::vector<Branch*> real_elements_1;
-    real_elements_0.reserve(Z);
-    real_elements_1.reserve(Z);
-
     // ============================================================
-    // 第三阶段：并行加密 (同样跳过 dummy)
+    // 第二、三阶段：批量并行解密 + 重新加密 (同一层密钥只展开一次)
     // ============================================================
-    // pool 中只包含非 dummy 元素，所以这里可以直接并行加密
-    #pragma omp parallel for
-    for(size_t i = 0; i < pool.size(); ++i) {
-        Branch* elem = pool[i];
-        elem->trueData = cryptor_->aes_encrypt(elem->trueData, HOTREE_level);
-    }
+    cryptor_->aes_decrypt_blocks(pool.data(), pool.size(), HOTREE_level);
+    cryptor_->aes_encrypt_blocks(pool.data(), pool.size(), HOTREE_level);
 
     // ============================================================
-    // 第四阶段：本地路由 (逻辑运算)
+    // 第四阶段：不经意路由 (批量哈希 + ORCompact，空位填静态 Dummy 指针)
     // ============================================================
     int check_bit = num_levels_shuffle - 1 - level_index;
-    int mask = 1 << check_bit;
     size_t mod_size = 1 << num_levels_shuffle; // 使用位运算替代 pow
-
-    for (auto* elem : pool) {
-        // compute_hash 是只读的，安全
-        if (compute_hash(combine_unique(elem->id, elem->counter_for_lastest_data), mod_size) & mask) {
-            real_elements_1.push_back(elem);
-        } else {
-            real_elements_0.push_back(elem);
-        }
-    }
-
-    // ============================================================
-    // 第五阶段：填充静态 Dummy 指针
-    // ============================================================
-    // 这里只填入指针，不创建新对象，非常安全且高效
-    while (real_elements_0.size() < Z) real_elements_0.push_back(&dummy_branch);
-    while (real_elements_1.size() < Z) real_elements_1.push_back(&dummy_branch);
-
-    bucket_out_0 = std::move(real_elements_0);
-    bucket_out_1 = std::move(real_elements_1);
+    RouteTwoWay(*this, pool, check_bit, mod_size, &dummy_branch, bucket_out_0, bucket_out_1);
 }
 
 void Client::ObliviousMergeSplit_firstlevel(
@@ -323,29 +544,10 @@ void Client::ObliviousMergeSplit_firstlevel(
         pool.push_back(s);
     }
     
-    std::vector<Branch*> real_elements_0;
-    std::vector<Branch*> real_elements_1;
-
-    // 2. 本地路由逻辑
+    // 2. 不经意路由 (批量哈希 + ORCompact)，空位填指针而不是填充对象
     int check_bit = num_levels_shuffle - 1 - level_index;
-    int mask = 1 << check_bit;
-
-    for (auto* elem : pool) {
-        if (compute_hash(combine_unique(elem->id, elem->counter_for_lastest_data), pow(2, num_levels_shuffle)) & mask) {
-            elem->trueData = cryptor_->aes_encrypt(elem->trueData, HOTREE_level);
-            real_elements_1.push_back(elem);
-        } else {
-            elem->trueData = cryptor_->aes_encrypt(elem->trueData, HOTREE_level);
-            real_elements_0.push_back(elem);
-        }
-    }
-
-    // 3. 填充指针而不是填充对象
-    while (real_elements_0.size() < Z) real_elements_0.push_back(&dummy_branch);
-    while (real_elements_1.size() < Z) real_elements_1.push_back(&dummy_branch);
-
-    bucket_out_0 = std::move(real_elements_0);
-    bucket_out_1 = std::move(real_elements_1);
+    cryptor_->aes_encrypt_blocks(pool.data(), pool.size(), HOTREE_level);
+    RouteTwoWay(*this, pool, check_bit, (size_t)1 << num_levels_shuffle, &dummy_branch, bucket_out_0, bucket_out_1);
 }
 
 
@@ -366,34 +568,12 @@ void Client::ObliviousMergeSplit_last_level(
     pool.reserve(bucket_in_0.size() + bucket_in_1.size());
 
     // ============================================================
-    // 第一阶段：并行解密 (必须严格保护共享的 dummy 节点)
+    // 第一、二阶段：收集 + 批量并行解密 (必须严格保护共享的 dummy 节点)
     // ============================================================
     // 这一步非常关键，必须先解密才能进行后续的 ID 比较排序
     omp_set_num_threads(num_threads);
 
-    // 处理 bucket_in_0
-    #pragma omp parallel for
-    for(size_t i = 0; i < bucket_in_0.size(); ++i) {
-        Branch* s = bucket_in_0[i];
-        // 核心修复：先判断是否为空或 Dummy，绝对不能对共享 Dummy 进行写操作！
-        if (s != nullptr && !s->is_dummy_for_shuffle) {
-            s->trueData = cryptor_->aes_decrypt(s->trueData, HOTREE_level);
-        }
-    }
-
-    // 处理 bucket_in_1
-    #pragma omp parallel for
-    for(size_t i = 0; i < bucket_in_1.size(); ++i) {
-        Branch* s = bucket_in_1[i];
-        // 核心修复：同上
-        if (s != nullptr && !s->is_dummy_for_shuffle) {
-            s->trueData = cryptor_->aes_decrypt(s->trueData, HOTREE_level);
-        }
-    }
-
-    // ============================================================
-    // 第二阶段：串行收集 (只收集 Real 元素)
-    // ============================================================
+    // 先串行收集 Real 元素 (绝对不能对共享 Dummy 进行写操作！)，再批量并行解密
     for(auto* s : bucket_in_0) {
         if (s != nullptr && !s->is_dummy_for_shuffle) {
             pool.push_back(s);
@@ -404,6 +584,7 @@ void Client::ObliviousMergeSplit_last_level(
             pool.push_back(s);
         }
     }
+    cryptor_->aes_decrypt_blocks(pool.data(), pool.size(), HOTREE_level);
 
     // ============================================================
     // ★★★ 第三阶段：全值排序 (替代原本的位运算路由) ★★★
@@ -430,11 +611,7 @@ void Client::ObliviousMergeSplit_last_level(
     // 第四阶段：并行加密 (同样跳过 dummy)
     // ============================================================
     // 排序后，Real 元素都在 pool 里，直接并行加密
-    #pragma omp parallel for
-    for(size_t i = 0; i < pool.size(); ++i) {
-        Branch* elem = pool[i];
-        elem->trueData = cryptor_->aes_encrypt(elem->trueData, HOTREE_level);
-    }
+    cryptor_->aes_encrypt_blocks(pool.data(), pool.size(), HOTREE_level);
 
     // ============================================================
     // 第五阶段：按顺序切分并填充 Dummy (Split)
@@ -472,109 +649,50 @@ void Client::ObliviousMergeSplit_last_level(
 }
 
 void Client::ObliviousMergeSplit_firstlevel_last_level(
-    std::vector<Branch*>& bucket_in_0,
-    std::vector<Branch*>& bucket_in_1,
-    std::vector<Branch*>& bucket_out_0,
-    std::vector<Branch*>& bucket_out_1,
-    int level_index,        // 在新逻辑中不再使用，但为了保持接口兼容保留
-    int num_levels_shuffle, // 在新逻辑中不再使用，但为了保持接口兼容保留
-    int HOTREE_level
+    const BucketSpan& bucket_in_0,
+    const BucketSpan& bucket_in_1,
+    const BucketSpan& bucket_out_0,
+    const BucketSpan& bucket_out_1
 ) {
-    // 1. 定义静态 Dummy，避免频繁 new/delete，且保证所有 Dummy 指向同一地址
-    static Branch dummy_branch(true, true);
+    // 每个线程复用一份 pool，避免每对桶都重新分配
+    static thread_local std::vector<RoutedSlot> pool;
+    pool.clear();
 
-    std::vector<Branch*> pool;
-    // 预留空间，避免 push_back 时的扩容开销
-    pool.reserve(bucket_in_0.size() + bucket_in_1.size());
-
-    // ============================================================
-    // 第一阶段：设置线程 (解密逻辑需确保在调用此函数前或在此处完成)
     // ============================================================
-    // 注意：std::sort 需要读取明文 ID。如果 bucket_in 中的数据是密文，
-    // 请确保在放入 pool 之前或在此处调用 aes_decrypt。
-    // 假设输入数据在此阶段 ID 是可读的。
-    omp_set_num_threads(num_threads);
-
+    // 第一阶段：按路由标记收集 Real 元素，判断 dummy 不需要访问节点
     // ============================================================
-    // 第二阶段：串行收集 Real 元素 (过滤掉 Dummy)
-    // ============================================================
-    // 我们只把真实的元素放入池中进行排序
-    for(auto* s : bucket_in_0) {
-        if (s != nullptr && !s->is_dummy_for_shuffle) {
-            pool.push_back(s);
-        }
-    }
-    for(auto* s : bucket_in_1) {
-        if (s != nullptr && !s->is_dummy_for_shuffle) {
-            pool.push_back(s);
+    // 每个输入桶的真实元素都按路由值升序 (初始桶在填充时排好，之后的桶由上一轮按序装满)
+    size_t real_0 = 0;
+    for (const BucketSpan* in : {&bucket_in_0, &bucket_in_1}) {
+        for (size_t t = 0; t < in->size; ++t) {
+            if (in->route[t] != dummy_route) pool.push_back({(*in)[t], in->route[t]});
         }
+        if (in == &bucket_in_0) real_0 = pool.size();
     }
 
     // ============================================================
-    // ★★★ 第三阶段：全值排序 (替代原本的路由逻辑) ★★★
+    // 第二阶段：归并两段有序的真实元素 (相同 ID 聚在一起，Counter 大的在前)
     // ============================================================
-    // 使用 std::sort 进行确定性排序：
-    // 1. 相同的 ID 会聚在一起。
-    // 2. 相同的 ID 中，Counter 大的（最新的）排在前面。
-    std::sort(pool.begin(), pool.end(), [](const Branch* a, const Branch* b) {
-        // 安全性检查 (虽然 pool 里应该没有 nullptr)
-        if (a == nullptr) return false;
-        if (b == nullptr) return true;
-
-        // 1. 第一优先级：按 ID 升序
-        if (a->id != b->id) {
-            return a->id < b->id;
-        }
-
-        // 2. 第二优先级：按 Counter 降序 (最新的在前)
-        return a->counter_for_lastest_data > b->counter_for_lastest_data;
+    std::inplace_merge(pool.begin(), pool.begin() + real_0, pool.end(), [](const RoutedSlot& a, const RoutedSlot& b) {
+        return a.route < b.route;
     });
 
-    // ============================================================
-    // 第四阶段：并行加密 (只加密 Real 元素)
-    // ============================================================
-    // 排序后，pool 中的元素顺序已定，现在并行更新它们的密文
-    #pragma omp parallel for
-    for(size_t i = 0; i < pool.size(); ++i) {
-        Branch* elem = pool[i];
-        // 重新加密数据块
-        elem->trueData = cryptor_->aes_encrypt(elem->trueData, HOTREE_level);
-    }
+    // 各轮只搬运明文指针，不在这里加密：输入只在进入网络前解密过一次，
+    // 逐轮重加密会叠加多层密钥流；去重后由 oblivious_shuffle_and_insert_last_level 统一加密一次
 
     // ============================================================
-    // 第五阶段：按顺序切分并填充 Dummy (Split)
+    // 第三阶段：按顺序依次装满两个输出桶，其余槽位标记为 dummy
     // ============================================================
-    // 清空并预留输出空间
-    bucket_out_0.clear();
-    bucket_out_1.clear();
-    bucket_out_0.reserve(Z);
-    bucket_out_1.reserve(Z);
-
-    size_t total_real = pool.size();
-
-    // --- 填充 Bucket 0 (取排序后的前 Z 个) ---
-    for (size_t i = 0; i < Z; ++i) {
-        if (i < total_real) {
-            bucket_out_0.push_back(pool[i]);
-        } else {
-            // Real 元素不够填满 Z，补 Dummy
-            bucket_out_0.push_back(&dummy_branch);
-        }
+    const size_t total_real = pool.size();
+    for (size_t i = 0; i < bucket_out_0.size; ++i) {
+        bool real = i < total_real;
+        bucket_out_0[i] = real ? pool[i].branch : nullptr;
+        bucket_out_0.route[i] = real ? pool[i].route : dummy_route;
     }
-
-    // --- 填充 Bucket 1 (取排序后的后 Z 个) ---
-    for (size_t i = 0; i < Z; ++i) {
-        // 计算在 pool 中的索引：Z + i
-        size_t pool_idx = Z + i;
-        
-        if (pool_idx < total_real) {
-            bucket_out_1.push_back(pool[pool_idx]);
-        } else {
-            // Real 元素耗尽，补 Dummy
-            bucket_out_1.push_back(&dummy_branch);
-        }
+    for (size_t i = 0; i < bucket_out_1.size; ++i) {
+        size_t pool_idx = bucket_out_0.size + i;
+        bool real = pool_idx < total_real;
+        bucket_out_1[i] = real ? pool[pool_idx].branch : nullptr;
+        bucket_out_1.route[i] = real ? pool[pool_idx].route : dummy_route;
     }
-    
-    // 此时 bucket_out_0 和 bucket_out_1 已经包含了排序并加密好的数据
-    // 且大小严格为 Z
-}
\ No newline at end of file
+}
@@ -4,12 +4,39 @@
 #include "Branch.h"
 #include <vector>
 #include <unordered_map>
+#include <memory>
+
+// shuffle 中 dummy 槽位的路由值
+constexpr size_t dummy_route = SIZE_MAX;
+
+// 最后一层 shuffle 的路由值：高 32 位是 id，低 32 位是按位取反的 counter，升序即 (id 升序, counter 降序)。
+// counter 非负，所以不会与 dummy_route 相同
+inline size_t version_route(const Branch* branch) {
+    uint64_t id_part = (uint64_t)((uint32_t)branch->id ^ 0x80000000u) << 32;
+    uint64_t counter_part = ~((uint32_t)branch->counter_for_lastest_data ^ 0x80000000u);
+    return id_part | counter_part;
+}
+
+// 指向双缓冲中一段连续槽位的视图 (不拥有内存)，butterfly 各层直接在 buffer 上读写；
+// route 与 data 平行，保存每个槽位元素的路由哈希 (hash % B)，dummy 为 dummy_route
+struct BucketSpan {
+    Branch** data = nullptr;
+    size_t* route = nullptr;
+    size_t size = 0;
+
+    Branch** begin() const { return data; }
+    Branch** end() const { return data + size; }
+    Branch*& operator[](size_t i) const { return data[i]; }
+};
 
 class Client {
 public:
     Cryptor* cryptor_;
     // std::unordered_map<int, Branch*> stash_;     // save the stash temprorary data
     std::vector<Branch*> stash_;
+    // stash_ 的 id -> 下标索引。每个 id 在 stash_ 中只有一份，再次取回时原地更新计数器
+    std::unordered_map<int, size_t> stash_index_;
+    int stash_accesses_ = 0; // 上次驱逐以来的 Retrieve 次数：驱逐节奏只取决于访问次数，与是否命中 stash 无关
     std::vector<size_t> vec_seed1_; // save the 1st hash seed every level
     std::vector<size_t> vec_seed2_; // save the 2nd hash seed every level
     std::vector<bool> vec_hotree_level_i_is_empty_; // flag if the level i is empty
@@ -18,10 +45,14 @@ public:
     int max_level_; // save the label of the maximum level
     // hash seed for oblivious shuffle (assign the place according to the id). This seed need to change per shuffle, but we retain it for simplicity.
     size_t seed_shuffle_;
+    std::vector<double> query_dense_; // 稠密化的查询权重 (字典大小)，跨查询复用
+    double query_norm_ = 0;           // 查询权重的范数，整个 SearchTopK 内不变
+    std::unique_ptr<EncBlock> decrypt_scratch_; // Self_healing_Access 解密未命中块用的缓冲区 (堆上，跨调用复用)
     double communication_round_trip_ = 0;
     double communication_volume_ = 0;
     int counter_access_ = 0;
     int counter_self_healing_access_ = 0;
+    int counter_retrieve_ = 0; // 调用 HOTree::Retrieve 的次数 (每次取回一个树节点)
     
     std::random_device rd;          // 随机设备
     std::mt19937 gen;               // 随机数生成引擎
@@ -34,24 +65,35 @@ public:
     size_t compute_hash1(uint64_t id, size_t level_i, size_t mod_size) const;
     size_t compute_hash2(uint64_t id, size_t level_i, size_t mod_size) const;
     size_t compute_hash(uint64_t id, size_t mod_size) const;
+    // 批量版 compute_hash：结果逐位相同，循环体无分支，便于编译器向量化
+    void compute_hash_batch(const uint64_t* ids, size_t n, size_t mod_size, size_t* out) const;
 
     int get_first_empty_level();
 
-    // 在 client.h 中增加：
+    void PushStash(Branch* branch);
+    void ClearStash();
+    // 在 stash_ 中查找 (id, counter)，返回 stash 中的节点本身 (不拷贝)；按 oblivious_stash_scan 选择实现
+    Branch* FindInStash(int id, int counter) const;
+
+    // 多路 merge-split：batched_in / batched_out 都是 buffer 上的视图，按组连续存放，每组 ways (=2^k) 个桶。
+    // 每组读 buffer_curr 的 ways 个桶，按路由哈希的 k 位 ((route >> route_shift) & (ways - 1)) 路由，直接写进 buffer_next 的 ways 个桶
     void ObliviousMergeSplit_Batched(
-        const std::vector<std::vector<Branch*>>& batched_in_0,
-        const std::vector<std::vector<Branch*>>& batched_in_1,
-        std::vector<std::vector<Branch*>>& batched_out_0,
-        std::vector<std::vector<Branch*>>& batched_out_1,
-        int level_index,
-        int num_levels_shuffle,
+        const std::vector<BucketSpan>& batched_in,
+        const std::vector<BucketSpan>& batched_out,
+        int ways,
+        int route_shift,
         int HOTREE_level,
         bool is_first_level
     );
 
-    double CalcuTextRelevancy(std::vector<double> weight1, std::vector<double> weight2);
+    double CalcuTextRelevancy(const SparseWeight& weight1, const SparseWeight& weight2);
 
     double CalcuTestSPaceRele(Branch *n1, Branch *n2);
+    // SearchTopK 的孩子批量打分：查询权重在 BeginQuery 中只稠密化一次，EndQuery 只把非零项清零
+    void BeginQuery(const Branch* query, size_t dic_size);
+    void EndQuery(const Branch* query);
+    // 一次遍历 node 中保存的孩子摘要，为所有孩子打分 (AVX-512/AVX2 每个通道一个孩子)，不做堆分配
+    void CalcuChildrenRele(const Branch* node, const Branch* query, double* scores) const;
     // Core Logic: Decrypt -> Sort based on Hash Bit -> Encrypt
     void ObliviousMergeSplit(
         std::vector<Branch*>& bucket_in_0,
@@ -80,14 +122,13 @@ public:
         int num_levels_shuffle,
         int HOTREE_level
     );
+    // 最后一层的 merge-split：输入输出都是双缓冲上的视图，两个输入桶的真实元素各自按路由值 (version_route) 有序，
+    // 归并后依次装满两个输出桶，输出桶因此仍然有序 (只搬运明文，加密在网络结束、去重之后做一次)
     void ObliviousMergeSplit_firstlevel_last_level(
-        std::vector<Branch*>& bucket_in_0,
-        std::vector<Branch*>& bucket_in_1,
-        std::vector<Branch*>& bucket_out_0,
-        std::vector<Branch*>& bucket_out_1,
-        int level_index,
-        int num_levels_shuffle,
-        int HOTREE_level
+        const BucketSpan& bucket_in_0,
+        const BucketSpan& bucket_in_1,
+        const BucketSpan& bucket_out_0,
+        const BucketSpan& bucket_out_1
     );
     void UpdateSeed(size_t level_i);
     // 生成随机数的函数
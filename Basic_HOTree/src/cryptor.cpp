@@ -1,10 +1,39 @@
 #include "cryptor.h"
 #include <cstring> // for std::memcpy, std::memset
+#include <atomic>
+#include <unordered_map>
 
 using namespace CryptoPP;
 
+namespace {
+// 少于该数量的块串行处理，避免开启并行区的开销
+constexpr size_t kParallelBlockThreshold = 64;
+// IV 生成器每次补充的 IV 个数 (一次 ProcessData 生成 kIvPoolSize * 16 字节密钥流)
+constexpr size_t kIvPoolSize = 64;
+
+std::atomic<uint64_t> g_cryptor_instances{0};
+
+struct ThreadCipherCache {
+    bool seeded = false;
+    std::vector<CTR_Mode<AES>::Encryption> ciphers;
+    // IV 生成器：随机密钥 + 随机初始计数器的 AES-CTR 密钥流，按块切成 IV
+    CTR_Mode<AES>::Encryption iv_gen;
+    unsigned char iv_pool[kIvPoolSize * AES::BLOCKSIZE];
+    size_t iv_pos = kIvPoolSize;
+};
+// 每个线程按 Cryptor 实例各保存一份，同一线程交替使用多个实例时不会互相覆盖、反复展开密钥
+thread_local std::unordered_map<uint64_t, ThreadCipherCache> t_cipher_caches;
+// 本线程最近使用的实例，连续处理同一实例的块时省去哈希查找 (unordered_map 的元素地址不会失效)
+thread_local uint64_t t_last_instance = 0;
+thread_local ThreadCipherCache* t_last_cache = nullptr;
+
+inline EncBlock* block_of(EncBlock* b) { return b; }
+inline EncBlock* block_of(Branch* b) { return &b->trueData; }
+}
+
 Cryptor::Cryptor(int L) {
     L_ = L;
+    instance_id_ = ++g_cryptor_instances;
     for(int i = 0; i <= L; i++) {
         CryptoPP::SecByteBlock key_temp;
         key_temp.resize(AES::DEFAULT_KEYLENGTH);
@@ -23,9 +52,7 @@ void Cryptor::aes_encrypt(const std::string& plain, std::string& cipher)
     // 修改点 1: 去掉 CryptoPP::，直接用 unsigned char 或全局 byte
     // 你的版本中 byte 是全局定义的，所以 CryptoPP::byte 是错的
     unsigned char iv[AES::BLOCKSIZE]; 
-    {
-        prng.GenerateBlock(iv, AES::BLOCKSIZE);
-    }
+    generate_iv(iv);
 
     encrypt_handler.SetKeyWithIV(key, key.size(), iv, AES::BLOCKSIZE);
 
@@ -49,9 +76,8 @@ std::string Cryptor::aes_encrypt(const std::string& plain, int i)
     CryptoPP::SecByteBlock key = key_vec[i];
     CTR_Mode<AES>::Encryption encrypt_handler;
 
-    AutoSeededRandomPool local_prng; // 在栈上创建，线程安全
     unsigned char iv[AES::BLOCKSIZE]; 
-    local_prng.GenerateBlock(iv, AES::BLOCKSIZE);
+    generate_iv(iv); // 线程本地 IV 生成器，不再每次构造 AutoSeededRandomPool
 
     encrypt_handler.SetKeyWithIV(key, key.size(), iv, AES::BLOCKSIZE);
 
@@ -127,6 +153,92 @@ std::string Cryptor::aes_decrypt(const std::string& cipher_full, int i)
     return plain;
 }
 
+std::vector<CTR_Mode<AES>::Encryption>& Cryptor::thread_level_ciphers()
+{
+    if (t_last_instance != instance_id_) {
+        t_last_cache = &t_cipher_caches[instance_id_];
+        t_last_instance = instance_id_;
+    }
+    ThreadCipherCache& cache = *t_last_cache;
+    if (!cache.seeded) {
+        // 第一次在该线程上使用这个 Cryptor：为每一层展开一次密钥
+        unsigned char zero_iv[AES::BLOCKSIZE] = {0};
+        cache.ciphers.clear();
+        cache.ciphers.resize(key_vec.size());
+        for (size_t level = 0; level < key_vec.size(); ++level) {
+            cache.ciphers[level].SetKeyWithIV(key_vec[level], key_vec[level].size(), zero_iv, AES::BLOCKSIZE);
+        }
+
+        // 每个线程只从 OS 熵源播种一次 (共享的 prng 不是线程安全的，需加锁)
+        CryptoPP::SecByteBlock seed_key(AES::DEFAULT_KEYLENGTH);
+        unsigned char seed_iv[AES::BLOCKSIZE];
+        {
+            std::lock_guard<std::mutex> lock(prng_mutex_);
+            prng.GenerateBlock(seed_key, seed_key.size());
+            prng.GenerateBlock(seed_iv, AES::BLOCKSIZE);
+        }
+        cache.iv_gen.SetKeyWithIV(seed_key, seed_key.size(), seed_iv, AES::BLOCKSIZE);
+        cache.iv_pos = kIvPoolSize;
+        cache.seeded = true;
+    }
+    return cache.ciphers;
+}
+
+void Cryptor::generate_iv(unsigned char* iv)
+{
+    thread_level_ciphers(); // 确保本线程的 IV 生成器已播种，并把本实例设为最近使用的实例
+    ThreadCipherCache& cache = *t_last_cache;
+    if (cache.iv_pos == kIvPoolSize) {
+        std::memset(cache.iv_pool, 0, sizeof(cache.iv_pool));
+        cache.iv_gen.ProcessData(cache.iv_pool, cache.iv_pool, sizeof(cache.iv_pool));
+        cache.iv_pos = 0;
+    }
+    std::memcpy(iv, cache.iv_pool + cache.iv_pos * AES::BLOCKSIZE, AES::BLOCKSIZE);
+    cache.iv_pos++;
+}
+
+void Cryptor::aes_encrypt_block(EncBlock& block, int i)
+{
+    CTR_Mode<AES>::Encryption& encrypt_handler = thread_level_ciphers()[i];
+
+    generate_iv(block.iv);
+
+    encrypt_handler.Resynchronize(block.iv, AES::BLOCKSIZE);
+    encrypt_handler.ProcessData(block.body(), block.body(), EncBlock::body_size());
+}
+
+void Cryptor::aes_decrypt_block(EncBlock& block, int i)
+{
+    // CTR 模式下解密与加密是同一个密钥流运算
+    CTR_Mode<AES>::Encryption& decrypt_handler = thread_level_ciphers()[i];
+
+    decrypt_handler.Resynchronize(block.iv, AES::BLOCKSIZE);
+    decrypt_handler.ProcessData(block.body(), block.body(), EncBlock::body_size());
+}
+
+template <typename T>
+static void encrypt_blocks_impl(Cryptor* cryptor, T* const* items, size_t n, int i)
+{
+    #pragma omp parallel for schedule(static) if(n >= kParallelBlockThreshold && !omp_in_parallel())
+    for (size_t k = 0; k < n; ++k) {
+        cryptor->aes_encrypt_block(*block_of(items[k]), i);
+    }
+}
+
+template <typename T>
+static void decrypt_blocks_impl(Cryptor* cryptor, T* const* items, size_t n, int i)
+{
+    #pragma omp parallel for schedule(static) if(n >= kParallelBlockThreshold && !omp_in_parallel())
+    for (size_t k = 0; k < n; ++k) {
+        cryptor->aes_decrypt_block(*block_of(items[k]), i);
+    }
+}
+
+void Cryptor::aes_encrypt_blocks(EncBlock* const* blocks, size_t n, int i) { encrypt_blocks_impl(this, blocks, n, i); }
+void Cryptor::aes_decrypt_blocks(EncBlock* const* blocks, size_t n, int i) { decrypt_blocks_impl(this, blocks, n, i); }
+void Cryptor::aes_encrypt_blocks(Branch* const* branches, size_t n, int i) { encrypt_blocks_impl(this, branches, n, i); }
+void Cryptor::aes_decrypt_blocks(Branch* const* branches, size_t n, int i) { decrypt_blocks_impl(this, branches, n, i); }
+
 // 辅助函数：将数据追加到 buffer
 void append_to_buffer(std::string& buf, const void* data, size_t size) {
     buf.append((const char*)data, size);
@@ -149,11 +261,11 @@ std::string Cryptor::encrypt_element(const Branch& elem) {
     append_to_buffer(buffer, &elem.is_empty_data, sizeof(elem.is_empty_data));
     append_to_buffer(buffer, &elem.m_rect, sizeof(elem.m_rect)); // Rectangle 是 POD
 
-    // 2. 序列化 std::vector<double> weight
+    // 2. 序列化 SparseWeight weight (term, weight) 对
     size_t weight_size = elem.weight.size();
     append_to_buffer(buffer, &weight_size, sizeof(size_t)); // 先存大小
     if (weight_size > 0) {
-        append_to_buffer(buffer, elem.weight.data(), weight_size * sizeof(double)); // 再存数据
+        append_to_buffer(buffer, elem.weight.data(), weight_size * sizeof(TermWeight)); // 再存数据
     }
 
     // 3. 序列化 std::string text
@@ -178,11 +290,11 @@ std::string Cryptor::encrypt_element(const Branch& elem, int i) {
     append_to_buffer(buffer, &elem.is_empty_data, sizeof(elem.is_empty_data));
     append_to_buffer(buffer, &elem.m_rect, sizeof(elem.m_rect)); // Rectangle 是 POD
 
-    // 2. 序列化 std::vector<double> weight
+    // 2. 序列化 SparseWeight weight (term, weight) 对
     size_t weight_size = elem.weight.size();
     append_to_buffer(buffer, &weight_size, sizeof(size_t)); // 先存大小
     if (weight_size > 0) {
-        append_to_buffer(buffer, elem.weight.data(), weight_size * sizeof(double)); // 再存数据
+        append_to_buffer(buffer, elem.weight.data(), weight_size * sizeof(TermWeight)); // 再存数据
     }
 
     // 3. 序列化 std::string text
@@ -213,13 +325,13 @@ Branch Cryptor::decrypt_element(const std::string& cipher) {
         read_from_buffer(plain, offset, &elem.is_empty_data, sizeof(elem.is_empty_data));
         read_from_buffer(plain, offset, &elem.m_rect, sizeof(elem.m_rect));
 
-        // 3. 反序列化 std::vector<double> weight
+        // 3. 反序列化 SparseWeight weight
         size_t weight_size = 0;
         read_from_buffer(plain, offset, &weight_size, sizeof(size_t));
         if (weight_size > 0) {
             elem.weight.resize(weight_size);
             // 直接读取数据到 vector 的内存中
-            read_from_buffer(plain, offset, elem.weight.data(), weight_size * sizeof(double));
+            read_from_buffer(plain, offset, elem.weight.data(), weight_size * sizeof(TermWeight));
         }
 
         // 4. 反序列化 std::string text
@@ -257,13 +369,13 @@ Branch Cryptor::decrypt_element(const std::string& cipher, int i) {
         read_from_buffer(plain, offset, &elem.is_empty_data, sizeof(elem.is_empty_data));
         read_from_buffer(plain, offset, &elem.m_rect, sizeof(elem.m_rect));
 
-        // 3. 反序列化 std::vector<double> weight
+        // 3. 反序列化 SparseWeight weight
         size_t weight_size = 0;
         read_from_buffer(plain, offset, &weight_size, sizeof(size_t));
         if (weight_size > 0) {
             elem.weight.resize(weight_size);
             // 直接读取数据到 vector 的内存中
-            read_from_buffer(plain, offset, elem.weight.data(), weight_size * sizeof(double));
+            read_from_buffer(plain, offset, elem.weight.data(), weight_size * sizeof(TermWeight));
         }
 
         // 4. 反序列化 std::string text
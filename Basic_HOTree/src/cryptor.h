@@ -7,6 +7,7 @@
 #include <cryptopp/osrng.h>
 #include <cryptopp/filters.h>
 #include <string>
+#include <mutex>
 // 最后包含你的自定义头文件
 #include "define.h"
 #include "Branch.h"
@@ -15,12 +16,20 @@ class Branch;
 class Cryptor {
 private:
     int L_; //Hierarchical level
+    uint64_t instance_id_; // 线程本地密钥缓存按实例区分的键
     CryptoPP::SecByteBlock default_key;
     std::vector<CryptoPP::SecByteBlock> key_vec;
     CryptoPP::AutoSeededRandomPool prng;
+    std::mutex prng_mutex_; // prng 只在播种线程本地 IV 生成器时使用，需加锁
+
+    // 当前线程上本实例的分层 CTR 对象：每个 (线程, 实例) 每层密钥只展开一次，之后每个块只需 Resynchronize IV
+    // (首次使用时同时为该线程播种本实例的 IV 生成器)
+    std::vector<CryptoPP::CTR_Mode<CryptoPP::AES>::Encryption>& thread_level_ciphers();
 
 public:
     Cryptor(int L);
+    // 生成 16 字节 IV：线程本地的 AES-CTR 密钥流 (DRBG)，只在首次使用时从 OS 播种一次
+    void generate_iv(unsigned char* iv);
     void aes_encrypt(const std::string& plain, std::string& cipher);
     void aes_decrypt(const std::string& cipher_full, std::string& plain);
     std::string encrypt_element(const Branch& elem);
@@ -30,6 +39,17 @@ public:
     std::string aes_decrypt(const std::string& cipher_full, int i);
     std::string encrypt_element(const Branch& elem, int i);
     Branch decrypt_element(const std::string& cipher, int i);
+
+    // 定长块的原地加解密：IV 写在块头，其余 BlockSize-16 字节原地做 AES-CTR
+    void aes_encrypt_block(EncBlock& block, int i);
+    void aes_decrypt_block(EncBlock& block, int i);
+
+    // 批量接口：在同一层密钥下处理 n 个块 (ObliviousMergeSplit / Eviction / Build)，
+    // 不在并行区内且块数较多时自动用 OpenMP 切分
+    void aes_encrypt_blocks(EncBlock* const* blocks, size_t n, int i);
+    void aes_decrypt_blocks(EncBlock* const* blocks, size_t n, int i);
+    void aes_encrypt_blocks(Branch* const* branches, size_t n, int i);
+    void aes_decrypt_blocks(Branch* const* branches, size_t n, int i);
 };
 
 #endif // CRYPTOR_H
\ No newline at end of file
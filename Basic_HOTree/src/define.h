@@ -14,6 +14,9 @@
 #include <iomanip>
 #include <random>
 #include <cstring>
+#include <cstdint>
+#include <stdexcept>
+#include <type_traits>
 #include <omp.h>
 
 #ifndef MY_BLOCK_SIZE
@@ -29,6 +32,13 @@ constexpr const double ALPHA = 0.5;      // 权重因子：0.5 表示空间和
 constexpr const int Z = 2048;            // Client stash size
 constexpr const int num_users = 16;    
 constexpr const int TEE_Z = Z*num_users;            
+constexpr int floor_log2(int x) { return x <= 1 ? 0 : 1 + floor_log2(x / 2); }
+// 多路 merge-split 每趟路由的哈希位数 k：一组 2^k 个桶 (2^k·Z 个块) 不超过一个批次的 client 内存 (2·TEE_Z 个块)
+constexpr const int shuffle_radix_bits = floor_log2(2 * TEE_Z / Z);
+// 最后一层蝶形网络的分块调度：连续 k 轮只在同一组 2^k 个桶之间交换数据，
+// 一组桶在双缓冲上的指针与路由 (2 · 2^k · Z 个槽位) 不超过这个预算，k 轮处理期间留在 L2 中
+constexpr const size_t shuffle_block_bytes = 1 << 20;
+constexpr const int shuffle_block_rounds = std::max(1, floor_log2((int)(shuffle_block_bytes / (2 * Z * (sizeof(void*) + sizeof(size_t))))));
 constexpr const size_t cuckoo_stash_size = 20;
 // constexpr const size_t BlockSize = 4096; // padding every encrypted data to 4096 Bytes
 constexpr const int num_threads = 16; 
@@ -36,6 +46,9 @@ constexpr const int debug_id = -337;
 constexpr const int child_debug_id = -18;
 constexpr const int global_seed = 200;
 constexpr const int if_is_debug = 0;
+// client stash 查找方式：false 用 id 哈希索引 (client 在可信环境中)；
+// true 时每次都常数时间扫描整个 stash 并用掩码选出命中项 (stash 驻留在 enclave 内，需防访存侧信道)
+constexpr const bool oblivious_stash_scan = false;
 
 
 // --- 2. 数据结构定义 ---
@@ -60,43 +73,55 @@ struct Rectangle {
 };
 
 
-static std::string padZero(const std::string& data) {
-    if (data.size() > BlockSize) {
-        throw std::invalid_argument("Data larger than target size");
-    }
-    
-    std::string padded = data;
-    padded.resize(BlockSize, '\0');
-    return padded;
+inline uint64_t combine_unique(int id, int counter) {
+    // 将 id 放在高 32 位，counter 放在低 32 位
+    // 注意：必须先转成 uint64_t 否则位移会溢出
+    return (static_cast<uint64_t>(id) << 32) | static_cast<uint32_t>(counter);
 }
 
-/**
- * 零填充解填充（去除尾部的零）
- * @param paddedData 填充后的数据
- * @return 原始数据
- */
-static std::string unpadZero(const std::string& paddedData) {
-    // 找到第一个零的位置
-    size_t endPos = paddedData.find('\0');
-    if (endPos == std::string::npos) {
-        // 没有零，返回全部数据
-        return paddedData;
-    }
-    
-    // 检查后面的字节是否都是零
-    for (size_t i = endPos; i < paddedData.size(); ++i) {
-        if (paddedData[i] != '\0') {
-            // 中间有非零字节，返回全部数据
-            return paddedData;
+// --- 3. 加密块格式 ---
+// 服务器上的每个块都是定长的 POD：IV | header | payload，总大小恰好为 BlockSize。
+// 加解密直接在块内原地进行（见 Cryptor::aes_encrypt_block），不再产生 std::string 的分配与拷贝。
+constexpr const size_t BlockIVSize = 16;
+
+struct BlockHeader {
+    int32_t id;
+    int32_t counter;
+    uint32_t payload_len;
+    uint32_t reserved;
+};
+
+constexpr const size_t BlockPayloadSize = BlockSize - BlockIVSize - sizeof(BlockHeader);
+
+struct alignas(64) EncBlock {
+    uint8_t iv[BlockIVSize];
+    BlockHeader header;
+    uint8_t payload[BlockPayloadSize];
+
+    void clear() { std::memset(this, 0, sizeof(EncBlock)); }
+
+    // 写入明文头部和载荷，剩余部分补零 (等价于原来的 padZero)
+    void pack(int id, int counter, const std::string& data) {
+        if (data.size() > BlockPayloadSize) {
+            throw std::invalid_argument("Data larger than block payload size");
         }
+        header.id = id;
+        header.counter = counter;
+        header.payload_len = static_cast<uint32_t>(data.size());
+        header.reserved = 0;
+        std::memcpy(payload, data.data(), data.size());
+        std::memset(payload + data.size(), 0, BlockPayloadSize - data.size());
+    }
+    std::string unpack() const {
+        size_t len = std::min<size_t>(header.payload_len, BlockPayloadSize);
+        return std::string(reinterpret_cast<const char*>(payload), len);
     }
-    
-    // 返回原始数据
-    return paddedData.substr(0, endPos);
-}
 
-static uint64_t combine_unique(int id, int counter) {
-    // 将 id 放在高 32 位，counter 放在低 32 位
-    // 注意：必须先转成 uint64_t 否则位移会溢出
-    return (static_cast<uint64_t>(id) << 32) | static_cast<uint32_t>(counter);
-}
\ No newline at end of file
+    // 需要加密的区域：IV 之后的全部字节
+    uint8_t* body() { return reinterpret_cast<uint8_t*>(&header); }
+    const uint8_t* body() const { return reinterpret_cast<const uint8_t*>(&header); }
+    static constexpr size_t body_size() { return BlockSize - BlockIVSize; }
+};
+static_assert(BlockSize % 64 == 0 && BlockSize >= 128, "BlockSize must be a multiple of 64 and at least 128 bytes");
+static_assert(sizeof(EncBlock) == BlockSize, "EncBlock must occupy exactly one BlockSize slab");
+static_assert(std::is_trivially_copyable<EncBlock>::value, "EncBlock must stay POD");
@@ -1,4 +1,6 @@
 #include "hotree.h"
+#include <parallel/algorithm>
+#include <unordered_map>
 using namespace std;
 
 void HOTree::print_stash() {
@@ -9,78 +11,31 @@ void HOTree::print_stash() {
 
 #include <unordered_set>
 
+// 取回的节点在各层之间移动而不是拷贝，节点只会在最大层合并去重时死亡：
+// 直接释放这次合并丢弃的旧版本，不再标记-清扫全部节点
 void HOTree::PerformGarbageCollection(int target_level) {
     // 1. 只有在最后一层（最大层）才进行清理
     if (target_level != client_->max_level_) return;
 
+    auto& discarded = vec_hashtable_[target_level]->discarded;
+    std::sort(discarded.begin(), discarded.end());
+    discarded.erase(std::unique(discarded.begin(), discarded.end()), discarded.end());
     if (if_is_debug) {
-        std::cout << "[GC] Start Garbage Collection. Before: " << all_branchs.size() << " objects." << std::endl;
-    }
-
-    // 2. [Mark 阶段] 收集所有“存活”的指针
-    // 存活的指针只存在于：该层的 Hash Table 和该层的 Stash
-    std::unordered_set<Branch*> active_pointers;
-    
-    // 收集 Table 中的指针
-    for (const auto& entry : vec_hashtable_[target_level]->table) {
-        if (entry.occupied && entry.branch != nullptr) {
-            active_pointers.insert(entry.branch);
-        }
-    }
-    
-    // 收集 Stash 中的指针 (注意：Eviction后，Stash已经移交回 client_->vector_every_level_stash_)
-    for (auto* ptr : client_->vector_every_level_stash_[target_level]) {
-        if (ptr != nullptr) {
-            active_pointers.insert(ptr);
-        }
-    }
-
-    // 3. [Sweep 阶段] 遍历全局池，保留活的，删除死的
-    std::vector<Branch*> survivors;
-    survivors.reserve(active_pointers.size());
-
-    for (Branch* ptr : all_branchs) {
-        // 如果指针在存活集合里，保留
-        if (active_pointers.find(ptr) != active_pointers.end()) {
-            survivors.push_back(ptr);
-        } 
-        // 否则，它是 Compaction 丢弃的旧版本或重复数据，彻底删除！
-        else {
-            delete ptr; 
-        }
-    }
-
-    // 4. 更新 all_branchs 为幸存者列表
-    all_branchs = std::move(survivors);
-
-    if (if_is_debug) {
-        std::cout << "[GC] End Garbage Collection. After: " << all_branchs.size() << " objects." << std::endl;
+        std::cout << "[GC] Release " << discarded.size() << " discarded objects." << std::endl;
     }
+    for (Branch* ptr : discarded) branch_slab_.Delete(ptr);
+    discarded.clear();
 }
 
 Branch* HOTree::Retrun_in_stash(size_t id, size_t counter, Client* client) {
-    Branch* result = nullptr;
-    for (size_t i = 0; i < client->stash_.size(); ++i) {
-        if (client->stash_[i] && client->stash_[i]->id == id && client->stash_[i]->counter_for_lastest_data == counter) {
-            {
-                result = new Branch(client->stash_[i]);
-                // ✅【修复】新增这一行：将新对象交给 HOTree 管理
-                all_branchs.push_back(result);
-            }
-        }
-    }
-    return result;
+    return client->FindInStash(id, counter);
 }
 
 Branch* HOTree::Retrun_in_stash(size_t id, size_t counter, const std::vector<Branch*> & stash_) {
     Branch* result = nullptr;
     for (size_t i = 0; i < stash_.size(); ++i) {
         if (stash_[i] && stash_[i]->id == id && stash_[i]->counter_for_lastest_data == counter) {
-            {
-                result = new Branch(stash_[i]);
-                // ✅【修复】新增这一行：将新对象交给 HOTree 管理
-                all_branchs.push_back(result);
-            }
+            result = stash_[i];
         }
     }
     return result;
@@ -174,14 +129,11 @@ Branch* HOTree::Retrun_in_stash_and_remove(size_t id, size_t counter, std::vecto
             }
         }
 
-        // 将结果汇总
+        // 将结果汇总：节点已从 level stash 摘除，直接交给调用方 (内存仍归 branch_slab_ 所有)
         if (local_found) {
             {
                 if (!found) {
-                    // result = local_result;
-                    result = new Branch(local_result);
-                    // ✅【修复】新增这一行：将新对象交给 HOTree 管理
-                    all_branchs.push_back(result);
+                    result = local_result;
                     found = true;
                 }
             }
@@ -223,9 +175,9 @@ void HOTree::findid(int target_id) {
                           << " in Level: " << level 
                           << ", Counter: " << entry.branch->counter_for_lastest_data << std::endl;
                 for(auto & triple : entry.branch->child_triple) {
-                    std::cout<<" child id "<< triple->id
-                             <<" child level "<<triple->level
-                             <<" child counter "<< triple->counter_for_lastest_data<<std::endl;
+                    std::cout<<" child id "<< triple.id
+                             <<" child level "<<triple.level
+                             <<" child counter "<< triple.counter_for_lastest_data<<std::endl;
                 }
             }
         }
@@ -237,9 +189,9 @@ void HOTree::findid(int target_id) {
                           << " in Level: " << level << " stash"
                           << ", Counter: " << branch_ptr->counter_for_lastest_data << std::endl;
                 for(auto & triple : branch_ptr->child_triple) {
-                    std::cout<<" child id "<< triple->id
-                             <<" child level "<<triple->level
-                             <<" child counter "<< triple->counter_for_lastest_data<<std::endl;
+                    std::cout<<" child id "<< triple.id
+                             <<" child level "<<triple.level
+                             <<" child counter "<< triple.counter_for_lastest_data<<std::endl;
                 }
             }
         }
@@ -251,9 +203,9 @@ void HOTree::findid(int target_id) {
                           << " in Level: " << level << " stash"
                           << ", Counter: " << branch_ptr->counter_for_lastest_data << std::endl;
                 for(auto & triple : branch_ptr->child_triple) {
-                    std::cout<<" child id "<< triple->id
-                             <<" child level "<<triple->level
-                             <<" child counter "<< triple->counter_for_lastest_data<<std::endl;
+                    std::cout<<" child id "<< triple.id
+                             <<" child level "<<triple.level
+                             <<" child counter "<< triple.counter_for_lastest_data<<std::endl;
                 }
             }
         }
@@ -275,11 +227,7 @@ HOTree::HOTree(const vector<string>& dict){
 
 HOTree::~HOTree() {
     
-    // 修改后：让 Branch 的析构函数自己负责 Triple 的清理
-    for (auto* b : all_branchs) {
-        if (b) delete b; // 这会自动调用 Branch::~Branch() 清理内部的 Triple
-    }
-    all_branchs.clear();
+    // 节点由 branch_slab_ 析构时统一释放 (会调用 Branch::~Branch() 清理内部的 Triple)
     
     // root 里的 Triple 是独立的，需要单独清理
     for (auto* t : root) delete t;
@@ -322,9 +270,9 @@ void HOTree::Eviction(Client* client) {
             for(auto & elem : client_->vector_every_level_stash_[level_i]) {
                 if(elem) {
                     elem->level = target_level;
-                    elem->trueData = client->cryptor_->aes_encrypt(elem->trueData, target_level);
+                    client->cryptor_->aes_encrypt_block(elem->trueData, target_level);
                     all_shuffled_branchs.push_back(elem);
-                    branchs_level_belong_to.push_back(level_i);
+                    branchs_level_belong_to.push_back(target_level); // level stash 在本地是明文，刚用 target_level 的密钥加密
                 }
             }
             client_->vector_every_level_stash_[level_i].clear();
@@ -351,6 +299,7 @@ void HOTree::Eviction(Client* client) {
         // if data have removed, clear hash table
         
         for(auto & elem : client_->vector_every_level_stash_[target_level]) {
+            if(elem == nullptr) continue; // removed by Retrun_in_stash_and_remove
             elem->level = target_level;
             all_shuffled_branchs.push_back(elem);
             branchs_level_belong_to.push_back(target_level);
@@ -365,8 +314,8 @@ void HOTree::Eviction(Client* client) {
     client->vec_hotree_level_i_is_empty_[target_level] = false; // level_i will be full
 
     /*-------------------------Move data of client stash to a vector-------------------------------*/
+    client->cryptor_->aes_encrypt_blocks(client->stash_.data(), client->stash_.size(), target_level);
     for (auto const& elem : client->stash_) {
-        elem->trueData = client->cryptor_->aes_encrypt(elem->trueData, target_level);
         elem->level = target_level;
         if(elem->id == debug_id && if_is_debug) {
             printf("id {%d} is in stash with counter {%d} \n", elem->id, elem->counter_for_lastest_data);
@@ -374,14 +323,12 @@ void HOTree::Eviction(Client* client) {
         all_shuffled_branchs.push_back(elem);
         branchs_level_belong_to.push_back(target_level);
     }
-    client->stash_.clear();
+    client->ClearStash();
 
     /*-------------------------update prediction level of all data-------------------------------*/
     for(auto & branch : all_shuffled_branchs) {
         for(auto & triple : branch->child_triple) {
-            if(triple->level < target_level) {
-                triple->level = target_level;
-            }
+            triple.level = std::max(triple.level, target_level);
         }
     }
     
@@ -392,7 +339,7 @@ void HOTree::Eviction(Client* client) {
     for(int i = 0; i < vec_hashtable_[target_level]->stash.size(); i++) {
         // move the stash to client, stash is so small that client is easy to save
         Branch* temp_branch = vec_hashtable_[target_level]->stash[i];
-        temp_branch->trueData = client->cryptor_->aes_decrypt(temp_branch->trueData, target_level);
+        client->cryptor_->aes_decrypt_block(temp_branch->trueData, target_level);
         client_->vector_every_level_stash_[target_level].push_back(temp_branch);
     }
     vec_hashtable_[target_level]->stash.clear();
@@ -434,29 +381,32 @@ Branch* HOTree::Access(uint64_t id, int counter_for_lastest_data, int level_i) {
                     std::cout<<"In search level"<< level_i <<" p1: "<<p1 << " seed: "<<client_->vec_seed1_[level_i]<<" table size"<< vec_hashtable_[i]->getTableCapacity()<<std::endl;
                 }
 
-                auto vec_temp_branch = vec_hashtable_[i]->find_hotree(id, p1, p2);
+                // 命中的块直接从表中移入 client stash (不再拷贝)，该槽位置空
+                result_branch = vec_hashtable_[i]->take_hotree(id, counter_for_lastest_data, p1, p2);
                 client_->communication_volume_ += BlockSize*2; // two blocks
-                for(auto& elem : vec_temp_branch) {
-                    if(elem != nullptr) {
-                        if(elem->id == id && elem->counter_for_lastest_data == counter_for_lastest_data) {
-                            result_branch = new Branch(elem);
-                            // ✅【修复】新增这一行：将新对象交给 HOTree 管理
-                            all_branchs.push_back(result_branch);
-                        }
-                    }
-                }
             }
             else {
                 size_t random = 2;
                 auto [p1, p2] = vec_hashtable_[i]->get_p1_p2(id_counter_combine + random, client_); //random access
                 client_->communication_volume_ += BlockSize*2; // two blocks
-                auto vec_temp_branch = vec_hashtable_[i]->find_hotree(id, p1, p2);
+                vec_hashtable_[i]->find_hotree(id, p1, p2);
             }
         }
     }
     return result_branch;
 }
 
+void HOTree::DummyAccess() {
+    // 与 Retrieve 走同一条路径：client stash、预测层的 level stash 和各层 cuckoo 表各探测一次，
+    // 通信量和 stash_accesses_ 的计数也相同，驱逐时机因此与真实/哑访问的比例无关。
+    // 哑 id 不对应任何节点，counter 每次不同，使预测层上的位置也是互不相同的伪随机位置
+    bool in_client_stash = false;
+    FetchBranch(kDummyAccessId, ++dummy_access_counter_, client_->max_level_, in_client_stash);
+    if(++client_->stash_accesses_ == Z) {
+        Eviction(client_);
+    }
+}
+
 Branch* HOTree::Self_healing_Access(int id, int counter_for_lastest_data, int prediction_level) {
     Branch* result_branch = nullptr;
     client_->communication_round_trip_ += 0.5; // only half trip, no need to put back
@@ -484,7 +434,7 @@ Branch* HOTree::Self_healing_Access(int id, int counter_for_lastest_data, int pr
         }
         else {
             if(result_branch == nullptr) {
-                Retrun_in_stash(id, counter_for_lastest_data, client_->stash_); // dummy lookup
+                Retrun_in_stash(id, counter_for_lastest_data, client_); // dummy lookup
                 // size_t p1 = client_->compute_hash1(combine_unique(id, counter_for_lastest_data), i, vec_hashtable_[i]->getTableCapacity());
                 // size_t p2 = client_->compute_hash2(combine_unique(id, counter_for_lastest_data), i, vec_hashtable_[i]->getTableCapacity());
                 auto [p1, p2] = vec_hashtable_[i]->get_p1_p2(combine_unique(id, counter_for_lastest_data), client_);
@@ -492,20 +442,22 @@ Branch* HOTree::Self_healing_Access(int id, int counter_for_lastest_data, int pr
                 if(id == debug_id && if_is_debug) {
                     std::cout<<"In self heal search level"<< i <<" p1: "<<p1 << " seed: "<<client_->vec_seed1_[i]<<" table size"<< vec_hashtable_[i]->getTableCapacity()<<std::endl;
                 }
-                auto vec_temp_branch = vec_hashtable_[i]->find_hotree(id, p1, p2);
+                auto temp_branchs = vec_hashtable_[i]->find_hotree(id, p1, p2);
                 int level_num_is_not_empty = count(client_->vec_hotree_level_i_is_empty_.begin() + client_->min_level_, client_->vec_hotree_level_i_is_empty_.begin() + client_->max_level_ + 1, false);
                 client_->communication_volume_ += level_num_is_not_empty*BlockSize*2; // two blocks
-                for(auto& elem : vec_temp_branch) {
-                    if(elem != nullptr) {
-                        elem->trueData = client_->cryptor_->aes_decrypt(elem->trueData, i);
-                        if(elem->id == id && elem->counter_for_lastest_data == counter_for_lastest_data) {
-                            result_branch = new Branch(elem);
-                            // ✅【修复】新增这一行：将新对象交给 HOTree 管理
-                            all_branchs.push_back(result_branch);
-                            return result_branch;
-                        }
+                for(auto& elem : temp_branchs) {
+                    if(elem != nullptr && (elem->id != id || elem->counter_for_lastest_data != counter_for_lastest_data)) {
+                        // 未命中的块解密到临时缓冲区，表中其它数据的密文保持不变
+                        EncBlock& scratch = *client_->decrypt_scratch_;
+                        scratch = elem->trueData;
+                        client_->cryptor_->aes_decrypt_block(scratch, i);
                     }
                 }
+                result_branch = vec_hashtable_[i]->take_hotree(id, counter_for_lastest_data, p1, p2);
+                if(result_branch != nullptr) {
+                    client_->cryptor_->aes_decrypt_block(result_branch->trueData, i);
+                    return result_branch;
+                }
             }
             // else { //dummy lookup but no need to decrypt beacause data have found
             //     size_t p1 = client_->getRandomIndex(vec_hashtable_[i]->getTableCapacity());
@@ -518,39 +470,23 @@ Branch* HOTree::Self_healing_Access(int id, int counter_for_lastest_data, int pr
     return result_branch;
 }
 
-Branch* HOTree::Retrieve(Client* client_, Triple*& triple) {
-    
-    Branch* child_branch = nullptr;
-    // 将要取回的id和该id所在的层的预测
-    int level_i = triple->level;
-    int id = triple->id;
-    if(if_is_debug) {
-        cout<<"We will retrieve id: "<<id<<endl;
-    }
-    
-    int counter_for_lastest_data = triple->counter_for_lastest_data;
-    
-    /*----------------------------------Find data in Client using linear scan-----------------------------------------*/
-    child_branch = Retrun_in_stash(id, counter_for_lastest_data, client_->stash_);
-
+Branch* HOTree::FetchBranch(int id, int counter_for_lastest_data, int level_i, bool& in_client_stash) {
+    /*----------------------------------Find data in Client stash-----------------------------------------*/
+    Branch* child_branch = Retrun_in_stash(id, counter_for_lastest_data, client_);
+    in_client_stash = (child_branch != nullptr);
 
     // lookup cuckoo stash to find the id if data is not in hash table. If found, delete from cuckoo stash and move to stash
+    auto& level_stash = client_->vector_every_level_stash_[level_i];
+    if(level_stash.size() > stash_max_value) {
+        stash_max_value = level_stash.size();
+    }
     if(child_branch == nullptr) {
-        auto& level_stash = client_->vector_every_level_stash_[level_i];
-        if(level_stash.size() > stash_max_value) {
-            stash_max_value = level_stash.size();
-        }
         child_branch = Retrun_in_stash_and_remove(id, counter_for_lastest_data, level_stash);
     }
     else {
         // dummy lookup
-        auto& level_stash = client_->vector_every_level_stash_[level_i];
-        if(level_stash.size() > stash_max_value) {
-            stash_max_value = level_stash.size();
-        }
         Retrun_in_stash_and_remove(id, counter_for_lastest_data, level_stash);
     }
-    
 
     /*----------------------------------Find data in Server cuckoo tables-----------------------------------------*/
     if(child_branch == nullptr) {
@@ -558,9 +494,9 @@ Branch* HOTree::Retrieve(Client* client_, Triple*& triple) {
         child_branch = Access(id, counter_for_lastest_data, level_i);
         if(child_branch!=nullptr) {
             // if getting the data, decryt it and update its status
-            child_branch->trueData = client_->cryptor_->aes_decrypt(child_branch->trueData, level_i); // decrypt the data using secret key in level i
+            client_->cryptor_->aes_decrypt_block(child_branch->trueData, level_i); // decrypt the data using secret key in level i
         }
-        else { // if not found, target id must be the level gerter than prediction level
+        else if(id != kDummyAccessId) { // if not found, target id must be the level gerter than prediction level
             child_branch = Self_healing_Access(id, counter_for_lastest_data, level_i);
         }
     }
@@ -568,6 +504,22 @@ Branch* HOTree::Retrieve(Client* client_, Triple*& triple) {
         // dummy lookup
         Access(id, counter_for_lastest_data, level_i);
     }
+    return child_branch;
+}
+
+Branch* HOTree::Retrieve(Client* client_, Triple*& triple) {
+    // 将要取回的id和该id所在的层的预测
+    int level_i = triple->level;
+    int id = triple->id;
+    if(if_is_debug) {
+        cout<<"We will retrieve id: "<<id<<endl;
+    }
+    
+    int counter_for_lastest_data = triple->counter_for_lastest_data;
+    client_->counter_retrieve_ += 1;
+
+    bool in_client_stash = false;
+    Branch* child_branch = FetchBranch(id, counter_for_lastest_data, level_i, in_client_stash);
 
     /*----------------------------------update prediction values-----------------------------------------*/
     // 取回数据后，不管是从本地还是server上取的，都已经确定访问了id一次，且取回来了，因此counter++，
@@ -577,9 +529,11 @@ Branch* HOTree::Retrieve(Client* client_, Triple*& triple) {
 
     child_branch->level = -1;
     child_branch->counter_for_lastest_data = triple->counter_for_lastest_data;
-    client_->stash_.push_back(child_branch); // move the data to stash
+    if(!in_client_stash) {
+        client_->PushStash(child_branch); // move the data to stash
+    }
 
-    if(client_->stash_.size() % Z == 0 && client_->stash_.size() != 0) {
+    if(++client_->stash_accesses_ == Z) {
         Eviction(client_);
     }
     return child_branch;
@@ -609,9 +563,9 @@ vector<pair<double, DataRecord>> HOTree::SearchTopK(double qx, double qy, string
     queryBranch->m_rect.min_Rec[1] = queryBranch->m_rect.max_Rec[1] = qy;
     queryBranch->CalcuKeyWordWeight(qText, dic_str);
     queryBranch->level = -1;
+    client_->BeginQuery(queryBranch, dic_str.size()); // 查询权重只稠密化一次
 
     priority_queue<LazySearchItem> pq;
-    double min_score = -1.0; 
 
     // 2. 初始层入队
     // 因为我们在 Build 里已经强制合并为单根(或少根)，这里 Retrieve 次数很少
@@ -628,16 +582,11 @@ vector<pair<double, DataRecord>> HOTree::SearchTopK(double qx, double qy, string
         
     }
     
-    // 3. 循环搜索
+    // 3. 循环搜索：按分数从高到低弹出，凑满 k 个数据节点即停止 (循环条件即终止条件，不另设剪枝)
     while (!pq.empty() && results.size() < k) {
         LazySearchItem top = pq.top();
         pq.pop(); 
 
-        // 剪枝
-        if (results.size() >= k && top.score < min_score) {
-            break; 
-        }
-
         Branch* curr = top.fetched_branch;
 
         // [关键逻辑改变]：如果 curr 为空，说明这是一个待访问的孩子，我们需要现在去取它 (Retrieve)
@@ -653,36 +602,22 @@ vector<pair<double, DataRecord>> HOTree::SearchTopK(double qx, double qy, string
         if (curr->child_triple.empty() || curr->id >= 0) { 
             // 找到结果
             results.push_back(make_pair(top.score, id_to_record_vec[curr->id]));
-            if (results.size() >= k) {
-                min_score = results.back().first;
-            }
         } else {
             // 是中间节点：展开子节点
             // [核心优化]：这里不再 Retrieve 孩子，而是利用 curr 中的摘要信息算分
             
-            // 确保 Build 阶段正确填充了 child_rects 和 child_weights_vec
+            // 确保 Build 阶段正确填充了 child_rects、child_weights_vec 和 child_norms_vec
             // 且大小与 child_triple 一致
             size_t child_count = curr->child_triple.size();
-            
-            for (size_t i = 0; i < child_count; i++) {
-                Triple* child_t = curr->child_triple[i];
-                
-                // --- 模拟计算分数 (不进行 Retrieve) ---
-                // 我们需要一个临时的 Branch 对象来辅助计算，或者重载 CalcuTestSPaceRele
-                // 这里创建一个轻量级的 "Stub" Branch
-                Branch* stub = new Branch();
-                stub->m_rect = curr->child_rects[i];         // 从父节点拿矩形
-                stub->weight = curr->child_weights_vec[i];   // 从父节点拿权重
-                // 注意：stub->text 没有，但 weight 已经有了，CalcuTestSPaceRele 应该使用 weight
-                
-                // 计算分数 (纯内存操作，无 IO)
-                double score = client_->CalcuTestSPaceRele(stub, queryBranch);
-                
-                delete stub; // 用完即弃
 
+            // --- 一次性为所有孩子打分 (纯内存操作，无 IO，无堆分配) ---
+            double child_scores[MAX_SIZE];
+            client_->CalcuChildrenRele(curr, queryBranch, child_scores);
+
+            for (size_t i = 0; i < child_count; i++) {
                 // 将 {分数, 目标ID, nullptr} 推入队列
                 // nullptr 表示"还没取回"，等它浮动到堆顶时再取
-                pq.push({score, child_t, nullptr});
+                pq.push({child_scores[i], &curr->child_triple[i], nullptr});
             }
             
             // 当前节点处理完毕，如果内存满了需要驱逐
@@ -693,116 +628,287 @@ vector<pair<double, DataRecord>> HOTree::SearchTopK(double qx, double qy, string
         // 但根据 Retrieve 的逻辑，它似乎返回一个 new 的对象。如果该对象被放入 stash，client 会管理。
         // 此处逻辑需根据 Retrieve 的内存管理策略微调。
     }
+    client_->EndQuery(queryBranch);
     delete queryBranch;
     return results;
 }
 
+vector<vector<pair<double, DataRecord>>> HOTree::SearchTopKBatch(const vector<DataRecord>& queries, int k, Client* client, int accesses_per_round) {
+    const size_t num_queries = queries.size();
+    vector<vector<pair<double, DataRecord>>> results(num_queries);
+    if (root.size() == 0 || k <= 0 || num_queries == 0) return results;
+    // 默认每轮访问 ceil(Q/4) 次：上层节点被大多数查询共享，去重后每轮需要的节点数远小于 Q
+    if (accesses_per_round <= 0) accesses_per_round = max(1, (int)(num_queries + 3) / 4);
+
+    // 每个查询的独立状态 (与 SearchTopK 中的局部变量一一对应)
+    struct BatchQuery {
+        Branch* queryBranch;
+        priority_queue<LazySearchItem> pq;
+    };
+    vector<BatchQuery> states(num_queries);
+    for (size_t q = 0; q < num_queries; q++) {
+        Branch* queryBranch = new Branch();
+        queryBranch->m_rect.min_Rec[0] = queryBranch->m_rect.max_Rec[0] = queries[q].x_coord;
+        queryBranch->m_rect.min_Rec[1] = queryBranch->m_rect.max_Rec[1] = queries[q].y_coord;
+        string qText = queries[q].processed_text;
+        queryBranch->CalcuKeyWordWeight(qText, dic_str);
+        queryBranch->level = -1;
+        states[q].queryBranch = queryBranch;
+    }
+
+    // 本批次已取回的节点 (按节点 id)。批次内每个节点最多取回一次，
+    // 所以所有查询看到的都是同一份拷贝，孩子的 Triple 也是同一组，不会出现过期的 counter
+    unordered_map<int, Branch*> fetched;
+
+    // 2. 根节点对所有查询都相同，先统一取回
+    for (auto & triple : root) {
+        fetched[triple->id] = Retrieve(client_, triple);
+    }
+    for (size_t q = 0; q < num_queries; q++) {
+        client_->BeginQuery(states[q].queryBranch, dic_str.size());
+        for (auto & triple : root) {
+            Branch* root_branch = fetched[triple->id];
+            double score = client_->CalcuTestSPaceRele(root_branch, states[q].queryBranch);
+            states[q].pq.push({score, triple, root_branch});
+        }
+        client_->EndQuery(states[q].queryBranch);
+    }
+
+    // 3. 按轮次同步推进
+    vector<Triple*> round_needs;
+    unordered_set<int> round_need_ids;
+    while (true) {
+        round_needs.clear();
+        round_need_ids.clear();
+
+        // 3.1 每个查询一直处理到堆顶需要一个尚未取回的节点为止
+        for (size_t q = 0; q < num_queries; q++) {
+            BatchQuery& st = states[q];
+            auto& res = results[q];
+            if (st.pq.empty() || res.size() >= (size_t)k) continue;
+
+            client_->BeginQuery(st.queryBranch, dic_str.size());
+            while (!st.pq.empty() && res.size() < (size_t)k) {
+                const LazySearchItem& top = st.pq.top();
+                Branch* curr = top.fetched_branch;
+                if (curr == nullptr) {
+                    auto it = fetched.find(top.triple_info->id);
+                    if (it == fetched.end()) {
+                        // 本轮需要取回该节点 (按 id 去重)
+                        if (round_need_ids.insert(top.triple_info->id).second) {
+                            round_needs.push_back(top.triple_info);
+                        }
+                        break;
+                    }
+                    curr = it->second;
+                }
+                LazySearchItem item = top;
+                st.pq.pop();
+
+                if (curr->child_triple.empty() || curr->id >= 0) {
+                    // 找到结果
+                    res.push_back(make_pair(item.score, id_to_record_vec[curr->id]));
+                } else {
+                    // 是中间节点：利用摘要为所有孩子打分并入队
+                    size_t child_count = curr->child_triple.size();
+                    double child_scores[MAX_SIZE];
+                    client_->CalcuChildrenRele(curr, st.queryBranch, child_scores);
+                    for (size_t i = 0; i < child_count; i++) {
+                        st.pq.push({child_scores[i], &curr->child_triple[i], nullptr});
+                    }
+                }
+            }
+            client_->EndQuery(st.queryBranch);
+        }
+
+        if (round_needs.empty()) break; // 所有查询都已完成
+
+        // 3.2 去重后的节点各取回一次，超出本轮预算的留到下一轮；不足的用哑访问补齐
+        size_t real_accesses = min(round_needs.size(), (size_t)accesses_per_round);
+        for (size_t i = 0; i < real_accesses; i++) {
+            fetched[round_needs[i]->id] = Retrieve(client_, round_needs[i]);
+        }
+        for (size_t i = real_accesses; i < (size_t)accesses_per_round; i++) {
+            DummyAccess();
+        }
+    }
+
+    for (auto& st : states) delete st.queryBranch;
+    return results;
+}
+
+
+namespace {
+inline double CenterX(const Branch* b) { return (b->m_rect.min_Rec[0] + b->m_rect.max_Rec[0]) / 2; }
+inline double CenterY(const Branch* b) { return (b->m_rect.min_Rec[1] + b->m_rect.max_Rec[1]) / 2; }
+
+// 二维 Hilbert 曲线下标：(x, y) 位于 2^order x 2^order 的网格上
+uint64_t HilbertIndex(uint32_t x, uint32_t y, int order) {
+    const uint32_t n = 1u << order;
+    uint64_t d = 0;
+    for (uint32_t s = n / 2; s > 0; s /= 2) {
+        uint32_t rx = (x & s) > 0;
+        uint32_t ry = (y & s) > 0;
+        d += (uint64_t)s * s * ((3 * rx) ^ ry);
+        // 旋转象限
+        if (ry == 0) {
+            if (rx == 1) {
+                x = n - 1 - x;
+                y = n - 1 - y;
+            }
+            std::swap(x, y);
+        }
+    }
+    return d;
+}
+constexpr int kHilbertOrder = 16;
+}
+
+void HOTree::OrderForPacking(vector<Branch*>& nodes, PackingMode mode, bool is_leaf_level) {
+    const size_t n = nodes.size();
+    if (n <= 1) return;
+    // 坐标相同时按 id 排，使树的形状与线程数无关
+    auto by_center_x = [](Branch* a, Branch* b) {
+        double ax = CenterX(a), bx = CenterX(b);
+        return ax != bx ? ax < bx : a->id < b->id;
+    };
+    auto by_center_y = [](Branch* a, Branch* b) {
+        double ay = CenterY(a), by = CenterY(b);
+        return ay != by ? ay < by : a->id < b->id;
+    };
+
+    switch (mode) {
+    case PackingMode::Legacy: {
+        if (!is_leaf_level) return; // 上层按已有顺序打包
+        // X 轴全局排序，再对每 MAX_SIZE 个做 Y 轴局部排序 (叶子的 min == max)
+        __gnu_parallel::sort(nodes.begin(), nodes.end(), by_center_x);
+        size_t num_chunks = (n + MAX_SIZE - 1) / MAX_SIZE;
+        #pragma omp parallel for schedule(static)
+        for (size_t c = 0; c < num_chunks; c++) {
+            sort(nodes.begin() + c * MAX_SIZE, nodes.begin() + min(n, (c + 1) * MAX_SIZE), by_center_y);
+        }
+        break;
+    }
+    case PackingMode::STR: {
+        // 共 P = ceil(n / M) 个父节点，切成 S = ceil(sqrt(P)) 个竖直条带，每个条带 S * M 个节点
+        size_t num_pages = (n + MAX_SIZE - 1) / MAX_SIZE;
+        size_t num_slabs = (size_t)ceil(sqrt((double)num_pages));
+        size_t slab_size = num_slabs * MAX_SIZE;
+        __gnu_parallel::sort(nodes.begin(), nodes.end(), by_center_x);
+        #pragma omp parallel for schedule(dynamic, 1)
+        for (size_t s = 0; s < num_slabs; s++) {
+            size_t begin = s * slab_size;
+            if (begin >= n) continue;
+            sort(nodes.begin() + begin, nodes.begin() + min(n, begin + slab_size), by_center_y);
+        }
+        break;
+    }
+    case PackingMode::Hilbert: {
+        // 把 MBR 中心归一化到 2^16 网格，计算 Hilbert 下标
+        double min_x = numeric_limits<double>::max(), max_x = numeric_limits<double>::lowest();
+        double min_y = min_x, max_y = max_x;
+        for (Branch* b : nodes) {
+            min_x = min(min_x, CenterX(b)); max_x = max(max_x, CenterX(b));
+            min_y = min(min_y, CenterY(b)); max_y = max(max_y, CenterY(b));
+        }
+        const double grid = (double)((1u << kHilbertOrder) - 1);
+        const double scale_x = max_x > min_x ? grid / (max_x - min_x) : 0.0;
+        const double scale_y = max_y > min_y ? grid / (max_y - min_y) : 0.0;
+
+        vector<pair<uint64_t, Branch*>> keyed(n);
+        #pragma omp parallel for schedule(static)
+        for (size_t i = 0; i < n; i++) {
+            uint32_t gx = (uint32_t)((CenterX(nodes[i]) - min_x) * scale_x);
+            uint32_t gy = (uint32_t)((CenterY(nodes[i]) - min_y) * scale_y);
+            keyed[i] = {HilbertIndex(gx, gy, kHilbertOrder), nodes[i]};
+        }
+        __gnu_parallel::sort(keyed.begin(), keyed.end(), [](const pair<uint64_t, Branch*>& a, const pair<uint64_t, Branch*>& b) {
+            return a.first != b.first ? a.first < b.first : a.second->id < b.second->id;
+        });
+        for (size_t i = 0; i < n; i++) nodes[i] = keyed[i].second;
+        break;
+    }
+    }
+}
+
+Branch* HOTree::PackParent(const vector<Branch*>& children, size_t begin, size_t end, int id, bool aggregate_weight) {
+    Branch* parent = branch_slab_.New(); //一个节点存MAX_SIZE个branch
+    parent->initRectangle(); // 初始化矩形
+    parent->id = id;
+    for (size_t i = begin; i < end; i++) {
+        Branch* childBranch = children[i];
+        // 聚合权重 (稀疏归并，无需补齐到字典大小)
+        if (aggregate_weight) parent->keyWeightUpdate(childBranch);
+        // record parent infomation
+        parent->rectUpdate(childBranch); // 更新父节点 MBR
+        parent->child_triple.push_back(Triple(childBranch->id, 0, 0));
+        parent->child_branch.push_back(childBranch);
+        // 关键：将孩子的摘要信息 (矩形、权重、范数) 保存到父节点中
+        parent->childSummaryUpdate(childBranch);
+    }
+    return parent;
+}
 
-void HOTree::Build(vector<DataRecord>& raw_data, Client* &client) {
+void HOTree::Build(vector<DataRecord>& raw_data, Client* &client, PackingMode mode) {
     // initial Client parameters using stash size Z and size of dataset N
     if (raw_data.empty()) return;
 
     id_to_record_vec = std::move(raw_data); 
-    vector<Branch*> position_branchs;
-    int temp_ID = 0;
-
-    // 1. 数据转换为 Branch
-    for (const auto& data : id_to_record_vec) {
-        Branch* mBranch = new Branch();
+    const size_t data_num = id_to_record_vec.size();
+    vector<Branch*> position_branchs(data_num);
+
+    // 1. 数据转换为 Branch (各叶子的关键词权重互相独立，并行计算)
+    #pragma omp parallel for schedule(dynamic, 256)
+    for (size_t i = 0; i < data_num; i++) {
+        const auto& data = id_to_record_vec[i];
+        Branch* mBranch = branch_slab_.New();
         mBranch->is_empty_data = false;
         mBranch->id = data.id;
         mBranch->text = data.processed_text;
-        // mBranch->trueData = client_->cryptor_->aes_encrypt(padZero(data.processed_text), L); // ciphertext, it has been padded to blocksize before encrypting
         
         mBranch->CalcuKeyWordWeight(mBranch->text, dic_str); //当前使用的是叶子节点，因此，他需要跟每个关键词计算相似度
 
         mBranch->m_rect.min_Rec[0] = mBranch->m_rect.max_Rec[0] = data.x_coord;
         mBranch->m_rect.min_Rec[1] = mBranch->m_rect.max_Rec[1] = data.y_coord;
-        // mBranch->pointBranch = mBranch;
-        // mBranch->curNode = nullptr;
 
-        // append the leaf branch to vector
-        all_branchs.push_back(mBranch);
-        position_branchs.push_back(mBranch);
-        temp_ID++;
+        position_branchs[i] = mBranch;
     }
-    int data_num = position_branchs.size();
+    // append the leaf branch to vector (保持数据顺序)
+    all_branchs.insert(all_branchs.end(), position_branchs.begin(), position_branchs.end());
 
-    // 3. STR 构建
-    vector<Branch*> Branchs_at_IR_tree;
-    
-    // X 轴排序
-    sort(position_branchs.begin(), position_branchs.begin() + data_num, 
-         [](Branch* a, Branch* b) { return a->m_rect.min_Rec[0] < b->m_rect.min_Rec[0]; });
+    // 3. 自底向上打包：每层先按打包方式重排，再每 MAX_SIZE 个节点打包成一个父节点。
+    // 各父节点互不依赖，并行打包；父节点 id 按位置预先分配 (与串行版本的编号顺序一致)
+    OrderForPacking(position_branchs, mode, true);
 
-    int current_idx = 0;
     int non_leaf_branch_id = -1;
-    while (current_idx < position_branchs.size()) {//每次处理MAX_SIZE个数据
-        int end_idx = min((size_t)(current_idx + MAX_SIZE), position_branchs.size());
-        
-        // Y 轴局部排序
-        if (current_idx < data_num) {
-             int sort_end = min(end_idx, data_num);
-             sort(position_branchs.begin() + current_idx, position_branchs.begin() + sort_end,
-                  [](Branch* a, Branch* b) { return a->m_rect.min_Rec[1] < b->m_rect.min_Rec[1]; });
-        }
-
-        Branch* parent_branch = new Branch();
-        if(non_leaf_branch_id == -229 && if_is_debug) {
-            cout<<"1";
-        }
-        parent_branch->id = non_leaf_branch_id--;
-        parent_branch->initRectangle(); // 初始化矩形
-        //MAX_SIZE个数据放在一个节点m_node中，这个node包含这些branch的矩形
-        for (int i = current_idx; i < end_idx; i++) {
-            Branch* b = position_branchs[i];
-            Triple* temp_triple = new Triple(b->id, 0, 0);
-            parent_branch->child_triple.push_back(temp_triple);
-            parent_branch->child_branch.push_back(b);
-            parent_branch->rectUpdate(b); 
-            parent_branch->child_rects.push_back(b->m_rect);
-            parent_branch->child_weights_vec.push_back(b->weight);
-        }
-        current_idx = end_idx;
-        Branchs_at_IR_tree.push_back(parent_branch);
-        all_branchs.push_back(parent_branch);
-    }
-
-    // 向上构建，构建父节点
+    size_t num_parents = (data_num + MAX_SIZE - 1) / MAX_SIZE;
+    vector<Branch*> Branchs_at_IR_tree(num_parents);
+    #pragma omp parallel for schedule(static)
+    for (size_t p = 0; p < num_parents; p++) {
+        size_t begin = p * MAX_SIZE;
+        size_t end = min(begin + MAX_SIZE, data_num);
+        // 叶子层的父节点不聚合权重 (与原实现一致)
+        Branchs_at_IR_tree[p] = PackParent(position_branchs, begin, end, non_leaf_branch_id - (int)p, false);
+    }
+    non_leaf_branch_id -= (int)num_parents;
+    all_branchs.insert(all_branchs.end(), Branchs_at_IR_tree.begin(), Branchs_at_IR_tree.end());
+
+    // 向上构建，构建父节点 (每一层内并行打包)
     while (Branchs_at_IR_tree.size() > MAX_SIZE) {
-        vector<Branch*> parent_branchs; //记录当前层的节点向量
-        int branch_idx = 0;
-        
-        while (branch_idx < Branchs_at_IR_tree.size()) {
-            Branch* parent = new Branch(); //一个节点存MAX_SIZE个branch
-            parent->initRectangle();
-            parent->id = non_leaf_branch_id--;
-            int pack_count = 0;
-
-            while (pack_count < MAX_SIZE && branch_idx < Branchs_at_IR_tree.size()) { //遍历孩子节点，每MAX_SIZE变成一个新的branch
-                Branch* childBranch = Branchs_at_IR_tree[branch_idx];
-                // 聚合权重
-                childBranch->weight.resize(dic_str.size(), 0.0);
-                parent->keyWeightUpdate(childBranch);
-                // record parent infomation
-                parent->rectUpdate(childBranch); // 更新父节点 MBR
-                Triple* temp_triple = new Triple(childBranch->id, 0, 0);
-                parent->child_triple.push_back(temp_triple);
-                parent->child_branch.push_back(childBranch);
-
-                // [修改点2] 关键：将孩子的摘要信息保存到父节点中
-                parent->child_rects.push_back(childBranch->m_rect);
-                // 确保 childBranch->weight 已经被正确计算或初始化
-                parent->child_weights_vec.push_back(childBranch->weight);
-
-                // append the non-leaf branch to vector
-                branch_idx++;
-                pack_count++;
-            }
-            parent_branchs.push_back(parent);
-            all_branchs.push_back(parent);
-        }
-        Branchs_at_IR_tree = parent_branchs;
+        OrderForPacking(Branchs_at_IR_tree, mode, false);
+        size_t level_size = Branchs_at_IR_tree.size();
+        num_parents = (level_size + MAX_SIZE - 1) / MAX_SIZE;
+        vector<Branch*> parent_branchs(num_parents); //记录当前层的节点向量
+        #pragma omp parallel for schedule(static)
+        for (size_t p = 0; p < num_parents; p++) {
+            size_t begin = p * MAX_SIZE;
+            size_t end = min(begin + MAX_SIZE, level_size);
+            parent_branchs[p] = PackParent(Branchs_at_IR_tree, begin, end, non_leaf_branch_id - (int)p, true);
+        }
+        non_leaf_branch_id -= (int)num_parents;
+        // append the non-leaf branch to vector
+        all_branchs.insert(all_branchs.end(), parent_branchs.begin(), parent_branchs.end());
+        Branchs_at_IR_tree.swap(parent_branchs);
     }
     if (!Branchs_at_IR_tree.empty()) {
         for(auto & b : Branchs_at_IR_tree) {
@@ -833,27 +939,35 @@ void HOTree::Build(vector<DataRecord>& raw_data, Client* &client) {
         }
     }
     
-    for(auto & branch : all_branchs) {
+    #pragma omp parallel for schedule(static)
+    for(size_t i = 0; i < all_branchs.size(); i++) {
+        Branch* branch = all_branchs[i];
         // update the branch itself information
         branch->level = L;
-        branch->trueData = client_->cryptor_->aes_encrypt(padZero(branch->text), L); // ciphertext, it has been padded to blocksize before encrypting
+        branch->trueData.pack(branch->id, branch->counter_for_lastest_data, branch->text); // plaintext is padded to blocksize inside the block
         // update the child level
         for(auto& triple : branch->child_triple) {
-            triple->level = L;
+            triple.level = L;
         }
-        
-        // insert
-        vec_hashtable_[L]->insert(branch, client_);
     }
 
+    // 整层一次性批量加密 (第 L 层密钥只展开一次)
+    client_->cryptor_->aes_encrypt_blocks(all_branchs.data(), all_branchs.size(), L);
+
+    // 逐 bin 并行构建第 L 层
+    vec_hashtable_[L]->build_from(all_branchs, client_);
+
     for(int i = 0; i < vec_hashtable_[L]->stash.size(); i++) {
         // move the stash to client, stash is so small that client is easy to save
         Branch* temp_branch = vec_hashtable_[L]->stash[i];
-        temp_branch->trueData = client_->cryptor_->aes_decrypt(temp_branch->trueData, L);
+        client_->cryptor_->aes_decrypt_block(temp_branch->trueData, L);
         client_->vector_every_level_stash_[L].push_back(temp_branch);
     }
     // vec_hashtable_[L]->stash.clear();
     client_->vec_hotree_level_i_is_empty_[L] = false;
+    // 节点的所有权在 branch_slab_，all_branchs 只用于建树
+    all_branchs.clear();
+    all_branchs.shrink_to_fit();
     // printf("Initially status is as following:");
     string temp = "After Oblivious Shuffle & Insert level: "+L;
     vec_hashtable_[L]->print_table_status(temp, client_->vector_every_level_stash_[L]);
@@ -3,6 +3,7 @@
 #include <map>
 #include <algorithm>
 #include <functional>
+#include <limits>
 #include "define.h"
 #include "DataReader.h"
 #include "cryptor.h"
@@ -10,28 +11,48 @@
 #include "Branch.h"
 #include "client.h"
 
+// IR-tree 的打包方式 (Build 时选择)
+enum class PackingMode {
+    Legacy,  // 全局按 x 排序，每 MAX_SIZE 个再按 y 排序 (仅叶子层)，上层按顺序打包
+    STR,     // Sort-Tile-Recursive：每层切成 sqrt(N/M) 个竖直条带，条带内按 y 排序
+    Hilbert  // 每层按 MBR 中心的 Hilbert 曲线下标排序
+};
+
 class HOTree {
 public:
+    static constexpr int kDummyAccessId = std::numeric_limits<int>::min(); // 哑访问使用的 id，不与任何节点 (叶子 >= 0，中间节点 < 0) 重合
     std::vector<std::string> dic_str;
     std::map<std::string, int> dic_map;
     std::vector<Triple*> root;
     std::vector<DataRecord> id_to_record_vec; 
     Client* client_;
     std::vector<std::unique_ptr<CuckooTable>> vec_hashtable_;
-    std::vector<Branch*> all_branchs; // for secure free memory
+    BranchSlab branch_slab_;          // 所有树节点的分配器，析构时释放仍存活的节点
+    std::vector<Branch*> all_branchs; // Build 时的全部节点 (建完即清空)
     int stash_max_value = 0;
+    int dummy_access_counter_ = 0; // 哑访问的计数器，用于生成互不相同的伪随机位置
     
 public:
     HOTree(const std::vector<std::string>& dict);
     ~HOTree();
     
-    void Build(std::vector<DataRecord>& raw_data, Client*& client);
+    void Build(std::vector<DataRecord>& raw_data, Client*& client, PackingMode mode = PackingMode::STR);
+    // Build 辅助：按打包方式重排一层节点，之后每连续 MAX_SIZE 个节点组成一个父节点
+    void OrderForPacking(std::vector<Branch*>& nodes, PackingMode mode, bool is_leaf_level);
+    // Build 辅助：把 children[begin, end) 打包成一个 id 为 id 的父节点 (只读 children，可并行调用)
+    Branch* PackParent(const std::vector<Branch*>& children, size_t begin, size_t end, int id, bool aggregate_weight);
     void Eviction(Client* client);
     Client* getClient();
     std::vector<std::pair<double, DataRecord>> SearchTopK(double qx, double qy, std::string qText, int k, Client* client);
+    // 批量 top-k：所有查询按轮次同步推进，每轮对需要的节点去重后各取回一次，
+    // 并用哑访问补齐到固定的 accesses_per_round 次 (<= 0 时取 ceil(查询个数 / 4))
+    std::vector<std::vector<std::pair<double, DataRecord>>> SearchTopKBatch(const std::vector<DataRecord>& queries, int k, Client* client, int accesses_per_round = 0);
     Branch* Retrieve(Client* client_, Triple*& triple);
+    // Retrieve 的探测部分：依次查 client stash、level_i 的 level stash 和服务器上的各层表，返回找到的节点
+    Branch* FetchBranch(int id, int counter_for_lastest_data, int level_i, bool& in_client_stash);
     Branch* Access(uint64_t id, int counter_for_lastest_data, int level_i);
     Branch* Self_healing_Access(int id, int counter_for_lastest_data, int prediction_level);
+    void DummyAccess(); // 填充用的哑访问，以 kDummyAccessId 走与 Retrieve 相同的探测和驱逐计数
     void PerformGarbageCollection(int target_level);
     
     Branch* Retrun_in_stash(size_t id, size_t counter, Client* client);
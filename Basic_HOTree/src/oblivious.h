@@ -0,0 +1,193 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+#include <omp.h>
+
+// 不经意原语：访存序列与控制流只取决于数据规模，与数据内容无关。
+// 压缩算法移植自 Doubly_HOTree/temp/include/ocompact.hpp (ORCompact / OROffCompact)，改写为 C++17、不依赖 TBB
+namespace oblivious {
+
+// flag 为 true 时交换 a 与 b：逐 64 位字做掩码异或，没有分支
+template <typename T>
+inline void cswap(T& a, T& b, bool flag) {
+    static_assert(std::is_trivially_copyable<T>::value, "cswap needs a trivially copyable type");
+    static_assert(sizeof(T) % sizeof(uint64_t) == 0, "cswap works on whole 64-bit words");
+    const uint64_t mask = ~((uint64_t)flag - 1);
+    unsigned char* pa = reinterpret_cast<unsigned char*>(&a);
+    unsigned char* pb = reinterpret_cast<unsigned char*>(&b);
+    for (size_t off = 0; off < sizeof(T); off += sizeof(uint64_t)) {
+        uint64_t wa, wb;
+        std::memcpy(&wa, pa + off, sizeof(uint64_t));
+        std::memcpy(&wb, pb + off, sizeof(uint64_t));
+        uint64_t diff = (wa ^ wb) & mask;
+        wa ^= diff;
+        wb ^= diff;
+        std::memcpy(pa + off, &wa, sizeof(uint64_t));
+        std::memcpy(pb + off, &wb, sizeof(uint64_t));
+    }
+}
+
+// flag 为 true 取 a，否则取 b
+inline size_t select(bool flag, size_t a, size_t b) {
+    const size_t mask = ~((size_t)flag - 1);
+    return b ^ ((a ^ b) & mask);
+}
+
+namespace detail {
+
+// 子问题小于该规模时不再拆成 OpenMP task
+constexpr size_t task_grain = 1 << 12;
+
+// 拆 task 的递归层数：比线程数的对数多一层，让 task 数略多于线程数
+inline int task_depth_for_threads() {
+    int depth = 0;
+    for (int threads = omp_get_max_threads(); threads > 1; threads /= 2) depth++;
+    return depth == 0 ? 0 : depth + 1;
+}
+
+inline size_t count_marked(const size_t* prefix, size_t start, size_t n) {
+    return n == 0 ? 0 : prefix[start + n - 1] - (start == 0 ? 0 : prefix[start - 1]);
+}
+
+// OROffCompact：对长度为 2 的幂的 data[start, start + n) 压缩，被标记元素按原顺序排在前面并整体循环左移 z。
+// prefix 是整个数组 (压缩前) 标记的前缀和；递归只在子区间内部置换，所以子区间的计数始终可以用它算出
+template <typename T>
+void off_compact(T* data, const size_t* prefix, size_t start, size_t z, size_t n, int task_depth) {
+    if (n <= 1) return;
+    if (n == 2) {
+        bool first_unmarked = count_marked(prefix, start, 1) == 0;
+        bool second_marked = count_marked(prefix, start + 1, 1) != 0;
+        cswap(data[start], data[start + 1], (first_unmarked & second_marked) ^ (bool)z);
+        return;
+    }
+    const size_t half = n / 2;
+    const size_t mod = half - 1;
+    const size_t m = count_marked(prefix, start, half);
+    if (task_depth > 0 && n > task_grain) {
+        #pragma omp task default(shared)
+        off_compact(data, prefix, start, z & mod, half, task_depth - 1);
+        off_compact(data, prefix, start + half, (z + m) & mod, half, task_depth - 1);
+        #pragma omp taskwait
+    } else {
+        off_compact(data, prefix, start, z & mod, half, 0);
+        off_compact(data, prefix, start + half, (z + m) & mod, half, 0);
+    }
+    const bool s = (((z & mod) + m) >= half) ^ (z >= half);
+    const size_t cut = (z + m) & mod;
+    T* lo = data + start;
+    T* hi = lo + half;
+    for (size_t i = 0; i < half; ++i) {
+        cswap(lo[i], hi[i], (i >= cut) ^ s);
+    }
+}
+
+// ORCompact：任意长度。前 n2 个递归压缩，后面 2 的幂长度的部分带偏移压缩，再用 n2 次条件交换拼起来
+template <typename T>
+void compact_any(T* data, const size_t* prefix, size_t start, size_t n, int task_depth) {
+    if (n <= 1) return;
+    size_t n1 = 1;
+    while (n1 * 2 <= n) n1 *= 2;
+    const size_t n2 = n - n1;
+    const size_t m = count_marked(prefix, start, n2);
+    compact_any(data, prefix, start, n2, task_depth);
+    off_compact(data, prefix, start + n2, (n1 - n2 + m) % n1, n1, task_depth);
+    for (size_t i = 0; i < n2; ++i) {
+        cswap(data[start + i], data[start + i + n1], i >= m);
+    }
+}
+
+} // namespace detail
+
+// 把 marks[i] != 0 的元素稳定地压缩到 data 前部 (未标记元素的次序不保证)，返回被标记的个数。
+// marks 只读；访存序列只取决于 n。task_depth > 0 时前 task_depth 层递归拆成 OpenMP task，
+// 需在 parallel 区域内调用，单独调用请用 compact_parallel
+template <typename T>
+size_t compact(T* data, const uint8_t* marks, size_t n, int task_depth = 0) {
+    static thread_local std::vector<size_t> prefix;
+    prefix.resize(n);
+    size_t sum = 0;
+    for (size_t i = 0; i < n; ++i) {
+        sum += marks[i] != 0;
+        prefix[i] = sum;
+    }
+    detail::compact_any(data, prefix.data(), 0, n, task_depth);
+    return sum;
+}
+
+// 开一个 parallel 区域，用 OpenMP task 并行执行 compact
+template <typename T>
+size_t compact_parallel(T* data, const uint8_t* marks, size_t n) {
+    const int depth = detail::task_depth_for_threads();
+    if (depth == 0 || n <= detail::task_grain) return compact(data, marks, n);
+    size_t marked = 0;
+    #pragma omp parallel
+    #pragma omp single
+    marked = compact(data, marks, n, depth);
+    return marked;
+}
+
+namespace detail {
+
+// 任意长度的 bitonic merge：先与最大的不超过 n 的 2 的幂距离做比较交换，再分别归并两段
+template <typename T, typename Less>
+void bitonic_merge(T* data, size_t n, bool ascending, const Less& less, int task_depth) {
+    if (n <= 1) return;
+    size_t m = 1;
+    while (m * 2 < n) m *= 2;
+    for (size_t i = 0; i + m < n; ++i) {
+        // ascending 时后者更小就交换，反之亦然；比较结果只决定是否交换，不影响访存
+        cswap(data[i], data[i + m], less(data[i + m], data[i]) == ascending);
+    }
+    if (task_depth > 0 && n > task_grain) {
+        #pragma omp task default(shared)
+        bitonic_merge(data, m, ascending, less, task_depth - 1);
+        bitonic_merge(data + m, n - m, ascending, less, task_depth - 1);
+        #pragma omp taskwait
+    } else {
+        bitonic_merge(data, m, ascending, less, 0);
+        bitonic_merge(data + m, n - m, ascending, less, 0);
+    }
+}
+
+template <typename T, typename Less>
+void bitonic_sort(T* data, size_t n, bool ascending, const Less& less, int task_depth) {
+    if (n <= 1) return;
+    const size_t m = n / 2;
+    if (task_depth > 0 && n > task_grain) {
+        #pragma omp task default(shared)
+        bitonic_sort(data, m, !ascending, less, task_depth - 1);
+        bitonic_sort(data + m, n - m, ascending, less, task_depth - 1);
+        #pragma omp taskwait
+    } else {
+        bitonic_sort(data, m, !ascending, less, 0);
+        bitonic_sort(data + m, n - m, ascending, less, 0);
+    }
+    bitonic_merge(data, n, ascending, less, task_depth);
+}
+
+} // namespace detail
+
+// 按 less 升序的 bitonic 排序 (任意长度，不稳定)。比较交换的位置序列只取决于 n，
+// less 应写成无分支的比较。task_depth 的含义同 compact
+template <typename T, typename Less>
+void bitonic_sort(T* data, size_t n, const Less& less, int task_depth = 0) {
+    detail::bitonic_sort(data, n, true, less, task_depth);
+}
+
+// 开一个 parallel 区域，用 OpenMP task 并行执行 bitonic_sort
+template <typename T, typename Less>
+void bitonic_sort_parallel(T* data, size_t n, const Less& less) {
+    const int depth = detail::task_depth_for_threads();
+    if (depth == 0 || n <= detail::task_grain) {
+        bitonic_sort(data, n, less);
+        return;
+    }
+    #pragma omp parallel
+    #pragma omp single
+    bitonic_sort(data, n, less, depth);
+}
+
+} // namespace oblivious
@@ -6,6 +6,18 @@ using namespace std;
 vector<string> dic_str;
 map<string, int> dic_map;
 
+namespace {
+// 明文树只模拟密文：把数据补零到一个块的大小
+std::string padZero(const std::string& data) {
+    if (data.size() > BlockSize) {
+        throw std::invalid_argument("Data larger than target size");
+    }
+    std::string padded = data;
+    padded.resize(BlockSize, '\0');
+    return padded;
+}
+}
+
 // ================= Rectangle 实现 =================
 
 Rectangle::Rectangle() {
@@ -216,4 +216,88 @@ BOOST_AUTO_TEST_CASE(test_query_timing) {
     // // 性能断言示例（你可以根据实际情况调整阈值）
     // BOOST_TEST(avg_time_ms < 100.0, "平均查询时间超过了100ms阈值");
 }
+BOOST_AUTO_TEST_CASE(test_search_topk_batch) {
+    // 批量查询 (含哑访问补齐) 的结果与明文 IR-Tree 对照，各打包方式都检查。
+    // 两棵树的结构不同，而节点摘要的分数不是孩子分数的上界，两边取到的 top-k 集合本来就可能不同 (test1 同理)；
+    // 这里检查与遍历顺序无关的部分：返回 k 个互不相同的数据，且每条的分数等于明文 IR-Tree 给该数据的分数
+    vector<string> dictionary = LoadDictionary("../../dataset/synthetic/keywords_dict.txt");
+    vector<DataRecord> data = readDataFromDataset("../../dataset/synthetic/dataset.txt", 5000);
+    vector<DataRecord> queries = readDataFromDataset("../../dataset/synthetic/query.txt", 300);
+    if (data.empty() || queries.empty()) {
+        BOOST_FAIL("Dataset is empty!");
+    }
+    int k = 5;
+
+    // 明文 IR-Tree 取全部数据，得到每个查询下每条数据的明文分数
+    vector<DataRecord> data_plain = data;
+    PlainIRTree irTree(dictionary);
+    irTree.Build(data_plain);
+    vector<map<int, double>> plain_scores(queries.size());
+    for (size_t q = 0; q < queries.size(); ++q) {
+        for (auto& [score, record] : irTree.SearchTopK(queries[q].x_coord, queries[q].y_coord, queries[q].processed_text, (int)data.size())) {
+            plain_scores[q][record.id] = score;
+        }
+    }
+
+    for (PackingMode mode : {PackingMode::Legacy, PackingMode::STR, PackingMode::Hilbert}) {
+        vector<DataRecord> data_batch = data;
+        Client* client_batch = nullptr;
+        HOTree hotree_batch(dictionary);
+        hotree_batch.Build(data_batch, client_batch, mode);
+        client_batch = hotree_batch.getClient();
+
+        auto batch_results = hotree_batch.SearchTopKBatch(queries, k, client_batch);
+        BOOST_REQUIRE_EQUAL(batch_results.size(), queries.size());
+
+        int mismatches = 0;
+        for (size_t q = 0; q < queries.size(); ++q) {
+            set<int> ids;
+            bool same = batch_results[q].size() == (size_t)k;
+            for (auto& [score, record] : batch_results[q]) {
+                auto it = plain_scores[q].find(record.id);
+                same = same && ids.insert(record.id).second && it != plain_scores[q].end() && std::fabs(it->second - score) < 1e-9;
+            }
+            if (!same) mismatches++;
+        }
+        cout << "PackingMode " << (int)mode << ": " << mismatches << " mismatches in " << queries.size() << " queries" << endl;
+        BOOST_TEST(mismatches == 0);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_payload_after_max_level_rebuild) {
+    // 顶层重建 (节点数超过 TEE_Z，走完整的最后一层 shuffle) 之后再取回的节点，解密出的头部与载荷必须与原节点一致
+    vector<string> dictionary = LoadDictionary("../../dataset/synthetic/keywords_dict.txt");
+    vector<DataRecord> data = readDataFromDataset("../../dataset/synthetic/dataset.txt", pow(2,15));
+    vector<DataRecord> queries = readDataFromDataset("../../dataset/synthetic/query.txt", 600);
+    if (data.empty() || queries.empty()) {
+        BOOST_FAIL("Dataset is empty!");
+    }
+
+    Client* client = nullptr;
+    HOTree hotree(dictionary);
+    hotree.Build(data, client);
+    client = hotree.getClient();
+
+    // 先查询一批，让取回的节点分散到较低的各层；再驱逐到各低层都满，下一次驱逐即为顶层重建
+    auto run_queries = [&](size_t begin, size_t end) {
+        for (size_t q = begin; q < end; ++q) {
+            hotree.SearchTopK(queries[q].x_coord, queries[q].y_coord, queries[q].processed_text, 3, client);
+        }
+    };
+    run_queries(0, queries.size() / 2);
+    while (client->get_first_empty_level() != client->max_level_) {
+        hotree.Eviction(client);
+    }
+    hotree.Eviction(client);
+
+    run_queries(queries.size() / 2, queries.size());
+    int corrupted = 0;
+    for (Branch* branch : client->stash_) {
+        const EncBlock& block = branch->trueData;
+        if (block.header.id != branch->id || block.unpack() != branch->text) corrupted++;
+    }
+    cout << corrupted << " corrupted payloads in " << client->stash_.size() << " retrieved blocks after a max-level rebuild" << endl;
+    BOOST_TEST(!client->stash_.empty());
+    BOOST_TEST(corrupted == 0);
+}
 BOOST_AUTO_TEST_SUITE_END()
\ No newline at end of file
@@ -109,6 +109,84 @@ BOOST_AUTO_TEST_CASE(test_cryptor_correctness) {
     std::cout << "[Pass] Branch Element Encryption (POD fields)" << std::endl;
 }
 
+BOOST_AUTO_TEST_CASE(test_block_inplace_correctness) {
+    int L = 5;
+    Cryptor cryptor(L);
+    std::string original_text = "In-place block encryption keeps IV, header and payload in one slab.";
+
+    EncBlock block;
+    block.pack(42, 7, original_text);
+    EncBlock plain_copy = block;
+
+    cryptor.aes_encrypt_block(block, 3);
+    // 密文区域必须发生变化
+    BOOST_CHECK(std::memcmp(block.body(), plain_copy.body(), EncBlock::body_size()) != 0);
+
+    EncBlock wrong_key = block;
+    cryptor.aes_decrypt_block(wrong_key, 4);
+    BOOST_CHECK(std::memcmp(wrong_key.body(), plain_copy.body(), EncBlock::body_size()) != 0);
+
+    cryptor.aes_decrypt_block(block, 3);
+    BOOST_CHECK_EQUAL(block.header.id, 42);
+    BOOST_CHECK_EQUAL(block.header.counter, 7);
+    BOOST_CHECK_EQUAL(block.unpack(), original_text);
+    BOOST_CHECK(std::memcmp(block.body(), plain_copy.body(), EncBlock::body_size()) == 0);
+
+    std::cout << "[Pass] In-place Block Encryption/Decryption" << std::endl;
+}
+
+BOOST_AUTO_TEST_CASE(test_block_batch_correctness) {
+    int L = 5;
+    Cryptor cryptor(L);
+    const size_t n = 200; // 超过并行阈值，走 OpenMP 路径
+
+    std::vector<EncBlock> blocks(n);
+    std::vector<EncBlock*> ptrs(n);
+    for (size_t k = 0; k < n; ++k) {
+        blocks[k].pack(static_cast<int>(k), 1, "batch block " + std::to_string(k));
+        ptrs[k] = &blocks[k];
+    }
+    std::vector<EncBlock> plain_copy = blocks;
+
+    cryptor.aes_encrypt_blocks(ptrs.data(), n, 2);
+    // 批量加密与逐块解密必须互通
+    cryptor.aes_decrypt_block(blocks[0], 2);
+    BOOST_CHECK_EQUAL(blocks[0].unpack(), "batch block 0");
+    cryptor.aes_encrypt_block(blocks[0], 2);
+
+    cryptor.aes_decrypt_blocks(ptrs.data(), n, 2);
+    for (size_t k = 0; k < n; ++k) {
+        BOOST_CHECK_EQUAL(blocks[k].header.id, static_cast<int>(k));
+        BOOST_CHECK(std::memcmp(blocks[k].body(), plain_copy[k].body(), EncBlock::body_size()) == 0);
+    }
+
+    std::cout << "[Pass] Batched Block Encryption/Decryption" << std::endl;
+}
+
+BOOST_AUTO_TEST_CASE(test_interleaved_instances) {
+    // 同一线程交替使用两个实例 (各自的密钥不同)，每个实例的密文只能被自己解开
+    int L = 5;
+    Cryptor first(L), second(L);
+    EncBlock a, b;
+    a.pack(1, 0, "first instance");
+    b.pack(2, 0, "second instance");
+    for (int round = 0; round < 3; ++round) {
+        first.aes_encrypt_block(a, 2);
+        second.aes_encrypt_block(b, 2);
+
+        EncBlock crossed = a;
+        second.aes_decrypt_block(crossed, 2);
+        BOOST_CHECK(crossed.unpack() != "first instance");
+
+        first.aes_decrypt_block(a, 2);
+        second.aes_decrypt_block(b, 2);
+        BOOST_CHECK_EQUAL(a.unpack(), "first instance");
+        BOOST_CHECK_EQUAL(b.unpack(), "second instance");
+    }
+
+    std::cout << "[Pass] Interleaved Cryptor Instances" << std::endl;
+}
+
 BOOST_AUTO_TEST_CASE(test_cryptor_performance) {
     // 1. 准备环境
     int L = 5;
@@ -116,7 +194,8 @@ BOOST_AUTO_TEST_CASE(test_cryptor_performance) {
     int test_key_index = 2;
     int iterations = 10000; // 迭代次数，可根据需要调整
     
-    std::string original_text = padZero("This is a performance test message for AES-CTR encryption.");
+    std::string original_text = "This is a performance test message for AES-CTR encryption.";
+    original_text.resize(BlockSize, '\0'); // 补零到一个块的大小
     std::string cipher_text;
     std::string recovered_text;
 
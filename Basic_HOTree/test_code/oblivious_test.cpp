@@ -0,0 +1,160 @@
+#define BOOST_TEST_MODULE ObliviousTest
+#include <boost/test/included/unit_test.hpp>
+#include <iostream>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <cstdint>
+
+#include <oblivious.h>
+#include <omp.h>
+
+using namespace std;
+
+// 压缩/排序的测试元素：value 是比较键，index 是原始位置 (用来检查稳定性与置换)
+struct Item {
+    uint64_t value;
+    uint64_t index;
+};
+
+// 覆盖 0、1、2 的幂、非 2 的幂，以及超过 task_grain (需要拆 OpenMP task) 的长度
+const vector<size_t> kLengths = {0, 1, 2, 3, 5, 7, 8, 13, 64, 100, 1000, 4097, 10000, 12345};
+
+vector<Item> make_items(size_t n, uint64_t value_range, mt19937_64& gen) {
+    vector<Item> items(n);
+    for (size_t i = 0; i < n; ++i) items[i] = {gen() % value_range, i};
+    return items;
+}
+
+// 被标记的元素按原顺序排在前 count 个，整体是输入的一个置换
+void check_compacted(const vector<Item>& input, const vector<uint8_t>& marks, const vector<Item>& output, size_t count) {
+    vector<uint64_t> expected_front;
+    for (size_t i = 0; i < input.size(); ++i) {
+        if (marks[i]) expected_front.push_back(input[i].index);
+    }
+    BOOST_REQUIRE_EQUAL(count, expected_front.size());
+    for (size_t i = 0; i < count; ++i) {
+        BOOST_REQUIRE_EQUAL(output[i].index, expected_front[i]);
+    }
+    vector<uint64_t> seen(input.size(), 0);
+    for (const Item& item : output) {
+        BOOST_REQUIRE_LT(item.index, input.size());
+        BOOST_REQUIRE_EQUAL(item.value, input[item.index].value);
+        seen[item.index]++;
+    }
+    BOOST_CHECK(all_of(seen.begin(), seen.end(), [](uint64_t c) { return c == 1; }));
+}
+
+// marks 按 pattern 生成：0 全不保留，1 全保留，2 随机保留约三成
+vector<uint8_t> make_marks(size_t n, int pattern, mt19937_64& gen) {
+    vector<uint8_t> marks(n);
+    for (size_t i = 0; i < n; ++i) {
+        marks[i] = (pattern == 1) || (pattern == 2 && gen() % 10 < 3);
+    }
+    return marks;
+}
+
+BOOST_AUTO_TEST_SUITE(oblivious_primitives_test)
+
+BOOST_AUTO_TEST_CASE(test_cswap_and_select) {
+    uint64_t a = 1, b = 2;
+    oblivious::cswap(a, b, false);
+    BOOST_CHECK_EQUAL(a, 1u);
+    BOOST_CHECK_EQUAL(b, 2u);
+    oblivious::cswap(a, b, true);
+    BOOST_CHECK_EQUAL(a, 2u);
+    BOOST_CHECK_EQUAL(b, 1u);
+
+    // 多个 64 位字的结构体整体交换
+    Item x{7, 0xFFFFFFFFFFFFFFFFull}, y{0, 3};
+    oblivious::cswap(x, y, false);
+    BOOST_CHECK(x.value == 7 && x.index == 0xFFFFFFFFFFFFFFFFull && y.value == 0 && y.index == 3);
+    oblivious::cswap(x, y, true);
+    BOOST_CHECK(x.value == 0 && x.index == 3 && y.value == 7 && y.index == 0xFFFFFFFFFFFFFFFFull);
+
+    BOOST_CHECK_EQUAL(oblivious::select(true, 5, 9), 5u);
+    BOOST_CHECK_EQUAL(oblivious::select(false, 5, 9), 9u);
+    BOOST_CHECK_EQUAL(oblivious::select(true, SIZE_MAX, 0), SIZE_MAX);
+    BOOST_CHECK_EQUAL(oblivious::select(false, SIZE_MAX, 0), 0u);
+}
+
+BOOST_AUTO_TEST_CASE(test_compact) {
+    mt19937_64 gen(42);
+    for (size_t n : kLengths) {
+        if (n > 1000) continue; // 单线程版本只测较短的长度，长的交给 compact_parallel
+        for (int pattern = 0; pattern < 3; ++pattern) {
+            vector<Item> input = make_items(n, 1000, gen);
+            vector<uint8_t> marks = make_marks(n, pattern, gen);
+            vector<Item> output = input;
+            size_t count = oblivious::compact(output.data(), marks.data(), n);
+            check_compacted(input, marks, output, count);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_compact_parallel) {
+    mt19937_64 gen(7);
+    // 单核机器上 task 深度为 0，指定线程数以覆盖拆 task 的路径
+    int saved_threads = omp_get_max_threads();
+    omp_set_num_threads(4);
+    for (size_t n : kLengths) {
+        for (int pattern = 0; pattern < 3; ++pattern) {
+            vector<Item> input = make_items(n, 1000, gen);
+            vector<uint8_t> marks = make_marks(n, pattern, gen);
+            vector<Item> output = input;
+            size_t count = oblivious::compact_parallel(output.data(), marks.data(), n);
+            check_compacted(input, marks, output, count);
+        }
+    }
+    omp_set_num_threads(saved_threads);
+}
+
+BOOST_AUTO_TEST_CASE(test_bitonic_sort_matches_std_sort) {
+    mt19937_64 gen(2024);
+    auto less = [](const Item& a, const Item& b) { return a.value < b.value; };
+    int saved_threads = omp_get_max_threads();
+    omp_set_num_threads(4);
+    for (size_t n : kLengths) {
+        // 值域小于长度时有大量重复键，值域很大时几乎没有
+        for (uint64_t value_range : {(uint64_t)16, (uint64_t)1 << 40}) {
+            vector<Item> input = make_items(n, value_range, gen);
+            vector<uint64_t> expected(n);
+            for (size_t i = 0; i < n; ++i) expected[i] = input[i].value;
+            sort(expected.begin(), expected.end());
+
+            vector<Item> serial = input;
+            vector<Item> parallel = input;
+            oblivious::bitonic_sort(serial.data(), n, less);
+            oblivious::bitonic_sort_parallel(parallel.data(), n, less);
+            for (size_t i = 0; i < n; ++i) {
+                BOOST_REQUIRE_EQUAL(serial[i].value, expected[i]);
+                BOOST_REQUIRE_EQUAL(parallel[i].value, expected[i]);
+            }
+
+            // 排序只是置换：每个原始位置恰好出现一次
+            vector<uint8_t> seen(n, 0);
+            for (const Item& item : parallel) seen[item.index]++;
+            BOOST_CHECK(all_of(seen.begin(), seen.end(), [](uint8_t c) { return c == 1; }));
+        }
+    }
+    omp_set_num_threads(saved_threads);
+}
+
+BOOST_AUTO_TEST_CASE(test_bitonic_sort_sorted_and_reversed_input) {
+    auto less = [](const Item& a, const Item& b) { return a.value < b.value; };
+    for (size_t n : {(size_t)31, (size_t)32, (size_t)1000}) {
+        vector<Item> ascending(n), descending(n);
+        for (size_t i = 0; i < n; ++i) {
+            ascending[i] = {i, i};
+            descending[i] = {n - 1 - i, i};
+        }
+        oblivious::bitonic_sort(ascending.data(), n, less);
+        oblivious::bitonic_sort(descending.data(), n, less);
+        for (size_t i = 0; i < n; ++i) {
+            BOOST_REQUIRE_EQUAL(ascending[i].value, i);
+            BOOST_REQUIRE_EQUAL(descending[i].value, i);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -187,12 +187,13 @@ void ocall_print_string(const char *str)
 
 #include "benchmark/query_vary_k.hpp"
 // #include "benchmark/query_vary_N.hpp"
+#include "test/rebuild_equivalence_test.hpp"
 /* Application entry */
 int SGX_CDECL main(int argc, char *argv[])
 {
-    (void)(argc);
-    (void)(argv);
-
+    // ./app test：只运行驱逐重建的等价性检查 (make test)
+    bool run_tests = (argc > 1 && strcmp(argv[1], "test") == 0);
+    int failures = 0;
 
     /* Initialize the enclave */
     if(initialize_enclave() < 0){
@@ -205,8 +206,12 @@ int SGX_CDECL main(int argc, char *argv[])
     /* Utilize trusted libraries */ 
     // ecall_libcxx_functions();
     
-    query_vary_k();
-    // query_vary_N();
+    if (run_tests) {
+        failures = rebuild_equivalence_test();
+    } else {
+        query_vary_k();
+        // query_vary_N();
+    }
 
     /* Destroy the enclave */
     sgx_destroy_enclave(global_eid);
@@ -215,6 +220,6 @@ int SGX_CDECL main(int argc, char *argv[])
 
     //printf("Enter a character before exit ...\n");
     //getchar();
-    return 0;
+    return failures == 0 ? 0 : 1;
 }
 
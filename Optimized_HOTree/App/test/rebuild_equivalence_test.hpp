@@ -0,0 +1,157 @@
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <omp.h>
+
+#include "hotree.h"
+#include "DataReader.h"
+#include "define.h"
+
+using namespace std;
+
+// 去摊销驱逐 (EvictionMode::Incremental) 的等价性检查，./app test 运行，返回失败项数
+// 1. 同一次重建：每次推进一个工作单元 (查询线程里的串行分步) 与一次做完 (后台线程的做法) 得到相同的新表
+// 2. 多用户查询与分步重建交错执行时，结果与同步驱逐 (StopTheWorld) 的参考树逐条一致
+
+namespace rebuild_test {
+
+const string dict_path = "../dataset/yelp/keywords_dict.txt";
+const string data_path = "../dataset/yelp/dataset.txt";
+const int test_N = (int)pow(2, 14);
+const int test_k = 3;
+
+bool same_results(const vector<pair<double, DataRecord>>& a, const vector<pair<double, DataRecord>>& b) {
+    if (a.size() != b.size()) return false;
+    for (size_t i = 0; i < a.size(); i++) {
+        if (fabs(a[i].first - b[i].first) > 1e-9 || a[i].second.id != b[i].second.id) return false;
+    }
+    return true;
+}
+
+// cuckoo 踢出用的是全局随机数，槽位不可比；比较两张表存放的 (id, counter) 集合，并逐个检查能按种子查到
+vector<pair<int, int>> table_contents(CuckooTable& table, Client* client, bool& findable) {
+    vector<pair<int, int>> contents;
+    for (auto& entry : table.table) {
+        if (entry.occupied) contents.push_back({entry.branch->id, entry.branch->counter_for_lastest_data});
+    }
+    for (auto* branch : table.stash) contents.push_back({branch->id, branch->counter_for_lastest_data});
+    for (auto& [id, counter] : contents) {
+        if (table.find(id, counter, client) == nullptr) findable = false;
+    }
+    sort(contents.begin(), contents.end());
+    return contents;
+}
+
+bool same_table(CuckooTable& a, CuckooTable& b, Client* client) {
+    bool findable = true;
+    auto contents_a = table_contents(a, client, findable);
+    auto contents_b = table_contents(b, client, findable);
+    return findable && contents_a == contents_b;
+}
+
+// 把各非空层表中的节点克隆一份，作为一次顶层重建的输入 (与 StepRebuild 的输入相同)
+vector<Branch*> clone_levels(HOTree& hotree, Client* client, vector<int>& belong) {
+    vector<Branch*> clones;
+    for (int level_i = client->min_level_; level_i <= client->max_level_; level_i++) {
+        if (client->vec_hotree_level_i_is_empty_[level_i]) continue;
+        for (auto& entry : hotree.vec_hashtable_[level_i]->table) {
+            if (!entry.occupied) continue;
+            clones.push_back(new Branch(entry.branch));
+            belong.push_back(level_i);
+        }
+    }
+    return clones;
+}
+
+// 用暂存种子把克隆重建成顶层表，每次推进 units_per_step 个工作单元
+unique_ptr<CuckooTable> rebuild_top_level(HOTree& hotree, Client* client, long long units_per_step, bool parallel,
+                                          long long& steps, vector<Branch*>& clones) {
+    vector<int> belong;
+    clones = clone_levels(hotree, client, belong);
+    vector<Branch*> input = clones;
+    int target_level = client->max_level_;
+    auto table = make_unique<CuckooTable>(pow(2, target_level), target_level);
+    table->seed_level_ = client->staging_seed_level();
+    table->begin_shuffle_and_insert(input, std::move(belong), client, false);
+    steps = 1;
+    while (!table->step_shuffle_and_insert(units_per_step, client, parallel)) steps++;
+    return table;
+}
+
+// 同一份输入：查询线程里逐单元串行推进 与 后台线程一次做完 得到相同的新表
+int incremental_matches_one_shot(HOTree& hotree, Client* client) {
+    client->UpdateSeed(client->staging_seed_level());
+    long long steps_once = 0, steps_step = 0;
+    vector<Branch*> clones_once, clones_step;
+    auto once = rebuild_top_level(hotree, client, numeric_limits<long long>::max(), true, steps_once, clones_once);
+    auto step = rebuild_top_level(hotree, client, 1, false, steps_step, clones_step);
+    bool same = same_table(*step, *once, client);
+    size_t input_size = clones_step.size();
+    for (Branch* branch : clones_once) delete branch;
+    for (Branch* branch : clones_step) delete branch;
+    if (!same) {
+        cout << "[FAIL] top level rebuilt from " << input_size << " blocks in " << steps_step
+             << " steps differs from the one-shot rebuild" << endl;
+        return 1;
+    }
+    cout << "[PASS] top level rebuilt from " << input_size << " blocks in " << steps_step
+         << " steps matches the one-shot rebuild" << endl;
+    return 0;
+}
+
+// 多个用户并行查询，分步重建穿插在它们的 Retrieve 里
+int interleaved_queries_stay_correct(HOTree& hotree, Client* client, HOTree& reference, Client* client_ref,
+                                     const vector<DataRecord>& queries) {
+    int num_queries = (int)queries.size();
+    vector<vector<pair<double, DataRecord>>> results(num_queries);
+    omp_set_num_threads(num_users);
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < num_queries; ++i) {
+        const auto& q = queries[i];
+        results[i] = hotree.SearchTopK(q.x_coord, q.y_coord, q.processed_text, test_k, client, i % num_users);
+    }
+
+    int mismatches = 0;
+    for (int i = 0; i < num_queries; ++i) {
+        const auto& q = queries[i];
+        auto expected = reference.SearchTopK(q.x_coord, q.y_coord, q.processed_text, test_k, client_ref, 0);
+        if (!same_results(results[i], expected)) mismatches++;
+    }
+    if (mismatches != 0) {
+        cout << "[FAIL] " << mismatches << " of " << num_queries << " interleaved queries differ from StopTheWorld" << endl;
+        return 1;
+    }
+    cout << "[PASS] " << num_queries << " queries interleaved with incremental rebuilds match StopTheWorld" << endl;
+    return 0;
+}
+
+} // namespace rebuild_test
+
+int rebuild_equivalence_test() {
+    vector<string> dict = LoadDictionary(rebuild_test::dict_path);
+    vector<DataRecord> data = readDataFromDataset(rebuild_test::data_path, rebuild_test::test_N);
+    vector<DataRecord> data_ref = data;
+    vector<DataRecord> queries = readDataFromDataset(rebuild_test::data_path, 12000);
+    if (dict.empty() || data.empty() || queries.empty()) {
+        cout << "Error: Dataset empty!" << endl;
+        return 1;
+    }
+    Client* client = nullptr;
+    Client* client_ref = nullptr;
+    HOTree hotree(dict), reference(dict);
+    hotree.eviction_mode_ = EvictionMode::Incremental;
+    reference.eviction_mode_ = EvictionMode::StopTheWorld;
+    hotree.Build(data, client);
+    reference.Build(data_ref, client_ref);
+    client = hotree.getClient();
+    client_ref = reference.getClient();
+
+    int failures = 0;
+    failures += rebuild_test::interleaved_queries_stay_correct(hotree, client, reference, client_ref, queries);
+    // 参考树此时已有多层数据，且没有进行中的重建，暂存种子槽位空闲
+    failures += rebuild_test::incremental_matches_one_shot(reference, client_ref);
+    return failures;
+}
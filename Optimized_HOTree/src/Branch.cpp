@@ -66,14 +66,9 @@ Branch::Branch(const Branch* other) {
     this->weight = other->weight;
     this->m_rect = other->m_rect;
 
-    // 2. 关键点：为 child_triple 创建全新的指针
-    this->child_triple.clear();
-    for (const auto* old_triple : other->child_triple) {
-        if (old_triple) {
-            // new 出一个新的 Triple 对象，保证地址完全独立
-            this->child_triple.push_back(new Triple(old_triple));
-        }
-    }
+    // 2. 关键点：child_triple 与原节点共享 (同一条父子边只有一份预测位置)，
+    //    任何副本上取回孩子都会更新它，其它副本不会留下过期的 counter
+    this->child_triple = other->child_triple;
     // 注意：父节点和子节点的指针处理
     // 通常在复制单个节点时，我们不希望简单的复制指针地址（那还是指向同一个地方）
     // 这里的逻辑根据你的业务需求决定：
@@ -88,10 +83,7 @@ Branch::Branch(const Branch* other) {
 }
 
 Branch::~Branch() {
-    for (auto* t : child_triple) {
-        if (t) delete t;
-    }
-    child_triple.clear();
+    child_triple.clear(); // shared_ptr：最后一个持有该 triple 的副本释放它
     
     child_branch.clear(); 
     // 注意：child_branch 只是指针引用，通常不需要在这里删除，
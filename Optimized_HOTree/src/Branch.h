@@ -3,25 +3,54 @@
 
 struct Triple {
     int id;
-    int level;
-    int counter_for_lastest_data;
+
+    // 预测位置：孩子所在的层与最新版本的计数器。同一条父子边在父节点的所有副本间共享一个 Triple，
+    // 多个用户会并发读写它，所以两者打包进一个原子字 (高 32 位 level，低 32 位 counter)，总是成对更新
+    struct Position {
+        int level;
+        int counter_for_lastest_data;
+        bool operator==(const Position& other) const {
+            return level == other.level && counter_for_lastest_data == other.counter_for_lastest_data;
+        }
+    };
     
     // 构造函数
-    Triple(int a, int b, int c) : id(a), level(b), counter_for_lastest_data(c) {}
-    
-    Triple(const Triple* other) {
-        if (other) {
-            this->id = other->id;
-            this->level = other->level;
-            this->counter_for_lastest_data = other->counter_for_lastest_data;
-        }
+    Triple(int a, int b, int c) : id(a), position_(pack(b, c)) {}
+
+    Position load() const { return unpack(position_.load()); }
+    int level() const { return load().level; }
+    int counter() const { return load().counter_for_lastest_data; }
+    void store(int level, int counter) { position_.store(pack(level, counter)); }
+
+    // 孩子被取回：counter 加一并改指它将被驱逐到的层，返回新的 counter
+    int advance(int next_level) {
+        uint64_t cur = position_.load();
+        while (!position_.compare_exchange_weak(cur, pack(next_level, unpack(cur).counter_for_lastest_data + 1))) {}
+        return unpack(cur).counter_for_lastest_data + 1;
+    }
+    // 驱逐把低于 min_level 的层并入 min_level，counter 不变
+    void raise_level(int min_level) {
+        uint64_t cur = position_.load();
+        while (unpack(cur).level < min_level &&
+               !position_.compare_exchange_weak(cur, pack(min_level, unpack(cur).counter_for_lastest_data))) {}
     }
 
     // 也可以重载输出运算符
     friend std::ostream& operator<<(std::ostream& os, const Triple& t) {
-        os << "(" << t.id << ", " << t.level << ", " << t.counter_for_lastest_data << ")";
+        Position p = t.load();
+        os << "(" << t.id << ", " << p.level << ", " << p.counter_for_lastest_data << ")";
         return os;
     }
+
+private:
+    std::atomic<uint64_t> position_;
+
+    static uint64_t pack(int level, int counter) {
+        return (static_cast<uint64_t>(static_cast<uint32_t>(level)) << 32) | static_cast<uint32_t>(counter);
+    }
+    static Position unpack(uint64_t word) {
+        return {static_cast<int>(static_cast<uint32_t>(word >> 32)), static_cast<int>(static_cast<uint32_t>(word))};
+    }
 };
 
 
@@ -43,7 +72,8 @@ public:
     // 存储子节点的关键词权重，用于父节点直接计算子节点的文本相关性
     std::vector<std::vector<double>> child_weights_vec; 
 
-    std::vector<Triple*> child_triple;
+    // 父节点的各个副本 (表中的旧版本、stash 中的新版本、重建克隆) 共享同一组 triple
+    std::vector<std::shared_ptr<Triple>> child_triple;
     std::vector<Branch*> child_branch;
     Branch* partent;
 
@@ -3,9 +3,11 @@
 #include <algorithm>
 #include <iostream>
 #include <cmath>
+#include <limits>
 
 CuckooTable::CuckooTable(size_t initial_size, int HOTREE_level) : current_count(0) {
     HOTREE_level_ = HOTREE_level;
+    seed_level_ = HOTREE_level;
     shuffle_count = 0;
     table.resize(initial_size);
     
@@ -35,11 +37,11 @@ std::vector<Branch*> CuckooTable::find_hotree(uint64_t id, size_t place1, size_t
 Branch* CuckooTable::find(uint64_t id, uint64_t counter_for_lastest_data, Client* client) {
     uint64_t id_and_counter = combine_unique(id, counter_for_lastest_data);
     // 1. Table Lookups
-    size_t p1 = client->compute_hash1(id_and_counter, HOTREE_level_, table.size());
+    size_t p1 = client->compute_hash1(id_and_counter, seed_level_, table.size());
     if (table[p1].occupied && table[p1].branch != nullptr && table[p1].branch->id == id && table[p1].branch->counter_for_lastest_data == counter_for_lastest_data) {
         return table[p1].branch;
     }
-    size_t p2 = client->compute_hash2(id_and_counter, HOTREE_level_, table.size());
+    size_t p2 = client->compute_hash2(id_and_counter, seed_level_, table.size());
     if (table[p2].occupied && table[p2].branch != nullptr && table[p2].branch->id == id && table[p2].branch->counter_for_lastest_data == counter_for_lastest_data) {
         return table[p2].branch;
     }
@@ -66,7 +68,7 @@ void CuckooTable::insert_internal(Branch* item, Client* client) {
 
     static std::mt19937 rng(global_seed); 
     for (int i = 0; i < MAX_KICKS; ++i) {
-        size_t p1 = client->compute_hash1(combine_unique(item->id, item->counter_for_lastest_data), HOTREE_level_, table.size());
+        size_t p1 = client->compute_hash1(combine_unique(item->id, item->counter_for_lastest_data), seed_level_, table.size());
         if (!table[p1].occupied) {
             table[p1].branch = item;
             table[p1].occupied = true;
@@ -74,7 +76,7 @@ void CuckooTable::insert_internal(Branch* item, Client* client) {
             return;
         }
 
-        size_t p2 = client->compute_hash2(combine_unique(item->id, item->counter_for_lastest_data), HOTREE_level_, table.size());
+        size_t p2 = client->compute_hash2(combine_unique(item->id, item->counter_for_lastest_data), seed_level_, table.size());
         if (!table[p2].occupied) {
             table[p2].branch = item;
             table[p2].occupied = true;
@@ -87,8 +89,8 @@ void CuckooTable::insert_internal(Branch* item, Client* client) {
         size_t victim_pos = kick_p1 ? p1 : p2;
         std::swap(item, table[victim_pos].branch);
     }
-    size_t p1 = client->compute_hash1(combine_unique(item->id, item->counter_for_lastest_data), HOTREE_level_, table.size());
-    size_t p2 = client->compute_hash2(combine_unique(item->id, item->counter_for_lastest_data), HOTREE_level_, table.size());
+    size_t p1 = client->compute_hash1(combine_unique(item->id, item->counter_for_lastest_data), seed_level_, table.size());
+    size_t p2 = client->compute_hash2(combine_unique(item->id, item->counter_for_lastest_data), seed_level_, table.size());
     if(if_is_debug) {
         if(table[p1].branch!=nullptr && table[p1].branch->id == debug_id) {
             std::cout<<"In insert id "<< table[p1].branch->id <<" level "<<HOTREE_level_ <<" p1: "<<p1 << " seed: "<<client->vec_seed1_[HOTREE_level_]<<" table size"<< table.size()<< " counter "<< table[p1].branch->counter_for_lastest_data<<std::endl;    
@@ -130,351 +132,252 @@ void CuckooTable::rehash(size_t new_size, Client* client) {
     }
 }
 
-std::vector<Branch*> CuckooTable::oblivious_tight_compaction(std::vector<Branch*> all_elements1, std::vector<int> branchs_level_belong_to, Client* client) {
-    std::vector<Branch*> result_branchs;
-    std::unordered_map<int, Branch*> unique_elements;
-    for (auto& elem : all_elements1) {
-        if (elem == nullptr) continue;
-
-        int id = elem->id;
-        // 如果 id 不存在，或者当前元素的 counter 更大，则更新/插入
-        if (unique_elements.find(id) == unique_elements.end() || 
-            elem->counter_for_lastest_data > unique_elements[id]->counter_for_lastest_data) {
-            unique_elements[id] = elem;
-        }
-    }
-    for (auto const& [id, elem] : unique_elements) {
-        if (id == debug_id && if_is_debug) {
-            printf("Inserting unique id %d with max counter %d in OHT.cpp\n", 
-                elem->id, elem->counter_for_lastest_data);
-        }
-        elem->level = HOTREE_level_;
-        elem->counter_for_lastest_data = 0;
-        for(auto & triple : elem->child_triple) {
-            triple->counter_for_lastest_data = 0;
-            triple->level = HOTREE_level_;
-        }
-        result_branchs.push_back(elem);
-        // all_elements.push_back(elem);
-    }
-    return result_branchs;
+void CuckooTable::oblivious_shuffle_and_insert(std::vector<Branch*>& all_elements_before_otc, std::vector<int> branchs_level_belong_to, Client* client) {
+    // 同步版本：一次推进到底
+    begin_shuffle_and_insert(all_elements_before_otc, std::move(branchs_level_belong_to), client);
+    step_shuffle_and_insert(std::numeric_limits<long long>::max(), client);
 }
 
-void CuckooTable::oblivious_shuffle_and_insert(std::vector<Branch*>& all_elements_before_otc, std::vector<int> branchs_level_belong_to, Client* client) {
+void CuckooTable::begin_shuffle_and_insert(std::vector<Branch*>& all_elements_before_otc, std::vector<int> branchs_level_belong_to, Client* client, bool reseed) {
     // 1. 初始化基础状态
     table.assign(pow(2, HOTREE_level_), Entry());
     stash.clear();
     current_count = 0;
-    client->UpdateSeed(HOTREE_level_);
-    std::vector<Branch*> all_elements;
-
-    // --- 模拟测试逻辑 / 特殊层级处理 (保持原逻辑不变) ---
-    if(all_elements_before_otc.size() <= TEE_Z) {
-        // ... (保持原始代码中的特殊处理逻辑) ...
-        // 为节省篇幅，此处省略未变动的小规模数据处理代码
-        if(HOTREE_level_ != client->max_level_) {
-            client->communication_round_trip_ += all_elements_before_otc.size()/TEE_Z;
-            client->communication_volume_ += all_elements_before_otc.size()*BlockSize;
-            for(auto &elem : all_elements_before_otc) insert(elem, client);
-            // std::cout<<"level_i: "<<HOTREE_level_ <<" N_real:"<< all_elements_before_otc.size()<<std::endl;
-            return;
+    if(reseed) client->UpdateSeed(seed_level_);
+    job_ = ShuffleJob();
+    job_.reseed = reseed;
+    bool is_last_level = (HOTREE_level_ == client->max_level_);
+    size_t N = all_elements_before_otc.size();
+    job_.elements = std::move(all_elements_before_otc);
+
+    // --- 小规模数据：直接插入 (最后一层先压缩去重) ---
+    if(N <= TEE_Z) {
+        if(!is_last_level) {
+            client->communication_round_trip_ += N/TEE_Z;
+            client->communication_volume_ += N*BlockSize;
+            job_.stage = ShuffleStage::Insert;
         } else {
-            client->communication_round_trip_ += 2*all_elements_before_otc.size()/TEE_Z;
-            client->communication_volume_ += 2*all_elements_before_otc.size()*BlockSize;
-            all_elements = oblivious_tight_compaction(all_elements_before_otc, branchs_level_belong_to, client);
-            for(auto &elem : all_elements) insert(elem, client);
-            return;
+            client->communication_round_trip_ += 2*N/TEE_Z;
+            client->communication_volume_ += 2*N*BlockSize;
+            job_.stage = ShuffleStage::Compact;
         }
+        return;
     }
-    
-    // 性能测试缓存逻辑
-    if(shuffle_tested_flag) { 
+
+    // 性能测试缓存逻辑：模拟模式下跳过 Shuffle，但仍需 insert 以维持功能正确性
+    if(shuffle_tested_flag) {
         shuffle_count++;
         client->communication_round_trip_ += single_shuffle_round_trips;
         client->communication_volume_ += single_shuffle_commucations;
-        // 模拟模式下，仍需执行必要的 insert 以维持功能正确性，但跳过 Shuffle
-        std::vector<Branch*>& target_elements = (HOTREE_level_ == client->max_level_) ? 
-            (all_elements = oblivious_tight_compaction(all_elements_before_otc, branchs_level_belong_to, client)) : all_elements_before_otc;
-        for(auto &elem : target_elements) insert(elem, client);
+        job_.stage = is_last_level ? ShuffleStage::Compact : ShuffleStage::Insert;
         return;
     } else {
         shuffle_tested_flag = true;
     }
 
-    double initial_volume = client->communication_volume_;
-    double initial_rounds = client->communication_round_trip_;
-    auto start_t = std::chrono::high_resolution_clock::now();
-
-    // 预处理数据
-    if(HOTREE_level_ != client->max_level_) {
-        all_elements = std::move(all_elements_before_otc);
-    } else {
-        // 最后一层特殊处理 (假设该函数内部未包含 insert)
-        oblivious_shuffle_and_insert_last_level(all_elements_before_otc, branchs_level_belong_to, client);
-        // 记录指标并返回
-        auto end_t = std::chrono::high_resolution_clock::now();
-        single_shuffle_times = std::chrono::duration_cast<std::chrono::microseconds>(end_t - start_t).count() / 1000.0;
-        single_shuffle_commucations = client->communication_volume_ - initial_volume;
-        single_shuffle_round_trips = client->communication_round_trip_ - initial_rounds;
-        return;
-    }
-
     // 2. 计算参数
-    int N_real = all_elements.size();
-    int B = (N_real > Z) ? pow(2, ceil(log2(2.0 * N_real / Z))) : pow(2, ceil(log2(2.0 * sqrt(N_real))));
-
-    // std::cout<<"level_i: "<<HOTREE_level_ <<" B: "<<B<<" N_real:"<<N_real<<std::endl;
-    int num_levels_shuffle = ceil(log2(B));
-    int total_nodes_per_level = B * Z;
-
-    /* This decryption step can be securely implemented by recording the layer 
-    where the input data itself is located (which the server can already know), 
-    and then decrypting the data within the ObliviousMergeSplit function based 
-    on the layer where the original data is located. All decrypted data is encrypted 
-    using the key corresponding to the new layer, but for the sake of concise and easy to 
-    understand code, we will decrypt it here. Note that this does not affect performance. */
-    omp_set_num_threads(num_threads);
-    #pragma omp parallel for schedule(static)
-    for(int i = 0; i < (int)all_elements.size(); i++) {
-        all_elements[i]->trueData = client->cryptor_->aes_decrypt(all_elements[i]->trueData, branchs_level_belong_to[i]);
-    }
-
-    // 4. 【优化 1 & 3】Ping-Pong 双缓冲 + 连续内存池
-    // 只分配两层所需的指针空间，大幅降低内存占用 (Cache Friendly)
-    std::vector<Branch*> buffer_curr(total_nodes_per_level, nullptr);
-    std::vector<Branch*> buffer_next(total_nodes_per_level, nullptr);
-
-    // 【优化 3】使用 vector 连续存储 Branch 对象，避免大量 new 造成的堆碎片
-    int num_dummies = total_nodes_per_level - all_elements.size();
-    // 注意：如果有跨层逻辑依赖指针地址唯一性，这里使用 vector 存储对象是安全的
-    // 只要 vector 不发生 realloc (reserve 足够空间)
-    std::vector<Branch> dummy_arena; 
-    if (num_dummies > 0) {
-        dummy_arena.reserve(num_dummies + B * Z); // 额外预留一些空间防止扩容
-        // 构造所有需要的 dummy (注意：这里在单线程预先构造，避免 OMP 中竞争)
-        // 使用 assign 填充比 push_back 更快
-        dummy_arena.assign(num_dummies, Branch(true, true)); 
-    }
-
-    // 填充 Level 0 (初始化 buffer_curr)
-    int data_idx = 0;
-    int dummy_idx = 0;
-    for(int b = 0; b < B; ++b) {
-        int base_offset = b * Z;
-        // 填充前半部分真实数据
-        int k = 0;
-        for(; k < Z/2 && data_idx < (int)all_elements.size(); ++k) {
-            buffer_curr[base_offset + k] = all_elements[data_idx++];
-        }
-        // 填充剩余部分为 Dummy
-        for(; k < Z; ++k) {
-            // 取出 dummy 对象的地址
-            buffer_curr[base_offset + k] = &dummy_arena[dummy_idx++];
-        }
-    }
+    job_.record_stats = true;
+    job_.last_level = is_last_level;
+    job_.dedup_on_insert = is_last_level;
+    job_.reset_on_insert = is_last_level;
+    job_.belong = std::move(branchs_level_belong_to);
+    job_.N_real = N;
+    job_.B = (job_.N_real > Z) ? pow(2, ceil(log2(2.0 * job_.N_real / Z))) : pow(2, ceil(log2(2.0 * sqrt(job_.N_real))));
+    job_.num_levels_shuffle = ceil(log2(job_.B));
+    job_.stage = ShuffleStage::Decrypt;
+}
 
-    // 5. 【优化 2】并行 Butterfly Network (Ping-Pong 模式)
-    for (int i = 0; i < num_levels_shuffle; ++i) {
-        // 预计算位运算所需的掩码，避免在循环内部做除法
-        const int p2i = 1 << i;
-        const int p2i_mask = p2i - 1; // 用于替代 % p2i
-        
-        #pragma omp parallel for schedule(static)
-        for (int j = 0; j < B / 2; ++j) {
-            // 【优化 2】位运算替代取模和除法
-            // 原逻辑: b1 = (j % p2i) + (j / p2i) * (2 * p2i);
-            // 优化后:
-            int b1 = (j & p2i_mask) + ((j >> i) << (i + 1));
-            int b2 = b1 + p2i;
-
-            // 【优化 4】使用迭代器区间构造，避免逐个 push_back
-            // vector 的范围构造函数通常底层使用 memcpy/memmove，速度极快
-            auto start_b1 = buffer_curr.begin() + b1 * Z;
-            std::vector<Branch*> bucket_i_b1(start_b1, start_b1 + Z);
-
-            auto start_b2 = buffer_curr.begin() + b2 * Z;
-            std::vector<Branch*> bucket_i_b2(start_b2, start_b2 + Z);
-
-            // 预分配输出 vector，避免 realloc
-            std::vector<Branch*> out_1(Z), out_2(Z);
-
-            if(i == 0) {
-                client->ObliviousMergeSplit_firstlevel(bucket_i_b1, bucket_i_b2, out_1, out_2, i, num_levels_shuffle, HOTREE_level_);
-            } else {
-                client->ObliviousMergeSplit(bucket_i_b1, bucket_i_b2, out_1, out_2, i, num_levels_shuffle, HOTREE_level_);
+bool CuckooTable::step_shuffle_and_insert(long long work_units, Client* client, bool parallel) {
+    auto start_t = std::chrono::high_resolution_clock::now();
+    auto elapsed_ms = [&]() {
+        auto end_t = std::chrono::high_resolution_clock::now();
+        return job_.elapsed_ms + std::chrono::duration_cast<std::chrono::microseconds>(end_t - start_t).count() / 1000.0;
+    };
+    auto record_stats = [&]() {
+        single_shuffle_times = elapsed_ms();
+        single_shuffle_commucations = job_.volume;
+        single_shuffle_round_trips = job_.round_trips;
+    };
+    const long long unit = 2LL * Z; // 一对桶的块数
+    long long budget = (work_units > std::numeric_limits<long long>::max() / unit) ?
+        std::numeric_limits<long long>::max() : work_units * unit;
+
+    while(job_.stage != ShuffleStage::Idle && budget > 0) {
+        switch(job_.stage) {
+        case ShuffleStage::Compact: {
+            // 最后一层：同一 id 只保留 counter 最大的版本
+            size_t end = job_.cursor + std::min<long long>(budget, job_.elements.size() - job_.cursor);
+            budget -= end - job_.cursor;
+            for(; job_.cursor < end; job_.cursor++) {
+                Branch* elem = job_.elements[job_.cursor];
+                if (elem == nullptr) continue;
+                int id = elem->id;
+                if (job_.unique_elements.find(id) == job_.unique_elements.end() ||
+                    elem->counter_for_lastest_data > job_.unique_elements[id]->counter_for_lastest_data) {
+                    job_.unique_elements[id] = elem;
+                }
             }
-
-            // 写回 buffer_next (连续内存写入)
-            int target_offset_1 = (2 * j) * Z;
-            int target_offset_2 = (2 * j + 1) * Z;
-            
-            // 使用 memcpy 或者 std::copy 替代手动循环赋值
-            // 只要 Branch* 是指针，copy 就是浅拷贝，非常快
-            std::copy(out_1.begin(), out_1.end(), buffer_next.begin() + target_offset_1);
-            std::copy(out_2.begin(), out_2.end(), buffer_next.begin() + target_offset_2);
-        }
-
-        // 统计更新 (移出 parallel 区域是正确的)
-        client->communication_round_trip_ += (B / 2) / num_threads;
-        client->communication_volume_ += (B / 2) * 2 * Z * BlockSize * 2; 
-
-        // 【关键】交换 Buffer，准备下一层
-        // std::swap 对 vector 只是交换内部指针，开销为 O(1)
-        std::swap(buffer_curr, buffer_next);
-    }
-
-    // 6. 记录纯 Shuffle 开销 (不含 insert)
-    auto end_t = std::chrono::high_resolution_clock::now();
-    single_shuffle_times = std::chrono::duration_cast<std::chrono::microseconds>(end_t - start_t).count() / 1000.0;
-    single_shuffle_commucations = client->communication_volume_ - initial_volume;
-    single_shuffle_round_trips = client->communication_round_trip_ - initial_rounds;
-
-    // 7. 最终插入阶段
-    // 此时结果在 buffer_curr 中 (因为最后一次循环做了 swap)
-    table.assign(pow(2, HOTREE_level_), Entry());
-    stash.clear();
-    current_count = 0;
-    client->UpdateSeed(HOTREE_level_);
-
-    for(Branch* branch : buffer_curr) {
-        if(branch != nullptr && !branch->is_dummy_for_shuffle) {
-            insert(branch, client);
+            if(job_.cursor == job_.elements.size()) {
+                job_.elements.clear();
+                for (auto const& [id, elem] : job_.unique_elements) job_.elements.push_back(elem);
+                job_.unique_elements.clear();
+                job_.reset_on_insert = true;
+                job_.cursor = 0;
+                job_.stage = ShuffleStage::Insert;
+            }
+            break;
         }
-    }
-    
-    // 8. 资源清理
-    // dummy_arena 会在函数结束时自动析构，无需手动 delete
-    // buffer vectors 也会自动释放
-}
-
-void CuckooTable::oblivious_shuffle_and_insert_last_level(std::vector<Branch*>& all_elements, std::vector<int> branchs_level_belong_to, Client* client) {
-    // 1. 参数计算
-    int N_real = all_elements.size();
-    int B = (N_real > Z) ? pow(2, ceil(log2(2.0 * N_real / Z))) : pow(2, ceil(log2(2.0 * sqrt(N_real))));
-    int num_levels_shuffle = ceil(log2(B));
-    int total_nodes_per_level = B * Z;
-
-    // 2. 并行解密 (保持原有的计算密集型优化)
-    omp_set_num_threads(num_threads);
-    #pragma omp parallel for schedule(static)
-    for(int i = 0; i < (int)all_elements.size(); i++) {
-        all_elements[i]->trueData = client->cryptor_->aes_decrypt(all_elements[i]->trueData, branchs_level_belong_to[i]);
-    }
-
-    // 3. 【优化】内存初始化 (NUMA 优化 + 内存池)
-    // 使用双缓冲 Ping-Pong 结构，替代昂贵的 memory[levels] 结构
-    std::vector<Branch*> buffer_curr(total_nodes_per_level);
-    std::vector<Branch*> buffer_next(total_nodes_per_level);
-
-    // 使用 parallel for 初始化以触发 NUMA 的 First-Touch 策略
-    #pragma omp parallel for schedule(static)
-    for(int i = 0; i < total_nodes_per_level; ++i) {
-        buffer_curr[i] = nullptr;
-        buffer_next[i] = nullptr;
-    }
-
-    // 【优化】Arena 方式分配 Dummy 对象
-    // 只需要分配填充第一层所需的 Dummy 即可，后续层级只是指针的置换
-    int num_dummies = total_nodes_per_level - N_real;
-    std::vector<Branch> dummy_arena;
-    if (num_dummies > 0) {
-        dummy_arena.reserve(num_dummies + B); // 预留少量 padding 防止溢出
-        dummy_arena.assign(num_dummies, Branch(true, true)); // 连续内存分配
-    }
-
-    // 4. 填充初始 Buffer (Level 0)
-    // 根据原逻辑：前 Z/2 个放真实数据，剩下的放 Dummy
-    int real_idx = 0;
-    int dummy_idx = 0;
-
-    for(int b = 0; b < B; ++b) {
-        int base_offset = b * Z;
-        int k = 0;
-        
-        // 填充真实数据
-        for(; k < Z/2 && real_idx < N_real; ++k) {
-            buffer_curr[base_offset + k] = all_elements[real_idx++];
+        case ShuffleStage::Decrypt: {
+            /* This decryption step can be securely implemented by recording the layer 
+            where the input data itself is located (which the server can already know), 
+            and then decrypting the data within the ObliviousMergeSplit function based 
+            on the layer where the original data is located. All decrypted data is encrypted 
+            using the key corresponding to the new layer, but for the sake of concise and easy to 
+            understand code, we will decrypt it here. Note that this does not affect performance. */
+            int first = job_.cursor;
+            int end = first + std::min<long long>(budget, job_.elements.size() - job_.cursor);
+            #pragma omp parallel for schedule(static) num_threads(num_threads) if(parallel)
+            for(int i = first; i < end; i++) {
+                job_.elements[i]->trueData = client->cryptor_->aes_decrypt(job_.elements[i]->trueData, job_.belong[i]);
+            }
+            budget -= end - first;
+            job_.cursor = end;
+            if(job_.cursor == job_.elements.size()) {
+                // 4. Ping-Pong 双缓冲 + 连续内存池：只分配两层所需的指针空间
+                int total_nodes_per_level = job_.B * Z;
+                job_.buffer_curr.assign(total_nodes_per_level, nullptr);
+                job_.buffer_next.assign(total_nodes_per_level, nullptr);
+                // 每个桶至少一半是 dummy，总数恰为 total - N_real；
+                // buffer 中保存的是 arena 内对象的地址，预留后不能再扩容
+                int num_dummies = total_nodes_per_level - job_.N_real;
+                if (num_dummies > 0) job_.dummy_arena.reserve(num_dummies);
+                job_.belong.clear();
+                job_.next_pair = 0;
+                job_.data_idx = 0;
+                job_.stage = ShuffleStage::Fill;
+            }
+            break;
         }
-        // 填充 Dummy 数据
-        for(; k < Z; ++k) {
-            buffer_curr[base_offset + k] = &dummy_arena[dummy_idx++];
+        case ShuffleStage::Fill: {
+            // 填充 Level 0：每个桶前 Z/2 个放真实数据，剩余部分为 Dummy
+            for(; job_.next_pair < job_.B && budget > 0; job_.next_pair++, budget -= Z) {
+                int base_offset = job_.next_pair * Z;
+                int k = 0;
+                for(; k < Z/2 && job_.data_idx < job_.N_real; ++k) {
+                    job_.buffer_curr[base_offset + k] = job_.elements[job_.data_idx++];
+                }
+                for(; k < Z; ++k) {
+                    job_.dummy_arena.emplace_back(true, true);
+                    job_.buffer_curr[base_offset + k] = &job_.dummy_arena.back();
+                }
+            }
+            if(job_.next_pair == job_.B) {
+                job_.elements.clear();
+                job_.level_index = 0;
+                job_.next_pair = 0;
+                job_.stage = ShuffleStage::Butterfly;
+            }
+            break;
         }
-    }
-
-    // 5. 【优化】并行 Butterfly Network
-    for (int i = 0; i < num_levels_shuffle; ++i) {
-        const int p2i = 1 << i;
-        const int mask = p2i - 1; // 用于位运算替代取模
-
-        #pragma omp parallel for schedule(static)
-        for (int j = 0; j < B / 2; ++j) {
-            // 【优化】位运算计算索引
-            int b1 = (j & mask) + ((j >> i) << (i + 1));
-            int b2 = b1 + p2i;
-
-            // 【优化】使用迭代器区间构造 Vector，利用底层 memcpy 加速
-            auto start_b1 = buffer_curr.begin() + b1 * Z;
-            std::vector<Branch*> bucket_i_b1(start_b1, start_b1 + Z);
-
-            auto start_b2 = buffer_curr.begin() + b2 * Z;
-            std::vector<Branch*> bucket_i_b2(start_b2, start_b2 + Z);
-
-            std::vector<Branch*> out_1(Z), out_2(Z);
-
-            // 调用 Last Level 特有的 Split 函数
-            // 原代码中 if(i==0) 和 else 调用的是同一个函数，这里直接统一调用
-            client->ObliviousMergeSplit_firstlevel_last_level(
-                bucket_i_b1, bucket_i_b2, out_1, out_2, 
-                i, num_levels_shuffle, HOTREE_level_
-            );
-
-            // 写回 buffer_next
-            int dest_idx_1 = (2 * j) * Z;
-            int dest_idx_2 = (2 * j + 1) * Z;
+        case ShuffleStage::Butterfly: {
+            // 5. 并行 Butterfly Network (Ping-Pong 模式)，每对桶是一个工作单元
+            const int i = job_.level_index;
+            const int B = job_.B;
+            const int p2i = 1 << i;
+            const int p2i_mask = p2i - 1; // 用于替代 % p2i
+            const int first = job_.next_pair;
+            const int end = first + std::min<long long>(B / 2 - first, std::max<long long>(1, budget / unit));
+            auto& buffer_curr = job_.buffer_curr;
+            auto& buffer_next = job_.buffer_next;
+
+            #pragma omp parallel for schedule(static) num_threads(num_threads) if(parallel)
+            for (int j = first; j < end; ++j) {
+                // 位运算替代取模和除法: b1 = (j % p2i) + (j / p2i) * (2 * p2i)
+                int b1 = (j & p2i_mask) + ((j >> i) << (i + 1));
+                int b2 = b1 + p2i;
+
+                auto start_b1 = buffer_curr.begin() + b1 * Z;
+                std::vector<Branch*> bucket_i_b1(start_b1, start_b1 + Z);
+                auto start_b2 = buffer_curr.begin() + b2 * Z;
+                std::vector<Branch*> bucket_i_b2(start_b2, start_b2 + Z);
+                std::vector<Branch*> out_1(Z), out_2(Z);
+
+                if(job_.last_level) {
+                    client->ObliviousMergeSplit_firstlevel_last_level(bucket_i_b1, bucket_i_b2, out_1, out_2, i, job_.num_levels_shuffle, HOTREE_level_, parallel);
+                } else if(i == 0) {
+                    client->ObliviousMergeSplit_firstlevel(bucket_i_b1, bucket_i_b2, out_1, out_2, i, job_.num_levels_shuffle, HOTREE_level_);
+                } else {
+                    client->ObliviousMergeSplit(bucket_i_b1, bucket_i_b2, out_1, out_2, i, job_.num_levels_shuffle, HOTREE_level_, parallel);
+                }
 
-            std::copy(out_1.begin(), out_1.end(), buffer_next.begin() + dest_idx_1);
-            std::copy(out_2.begin(), out_2.end(), buffer_next.begin() + dest_idx_2);
+                std::copy(out_1.begin(), out_1.end(), buffer_next.begin() + (2 * j) * Z);
+                std::copy(out_2.begin(), out_2.end(), buffer_next.begin() + (2 * j + 1) * Z);
+            }
+            budget -= (end - first) * unit;
+            job_.next_pair = end;
+            if(job_.next_pair < B / 2) break;
+
+            // 本层完成：统计更新并交换 Buffer
+            auto round_trips = (B / 2) / num_threads;
+            auto volume = (B / 2) * 2 * Z * BlockSize * 2;
+            client->communication_round_trip_ += round_trips;
+            client->communication_volume_ += volume;
+            job_.round_trips += round_trips;
+            job_.volume += volume;
+            std::swap(buffer_curr, buffer_next);
+            job_.level_index++;
+            job_.next_pair = 0;
+            if(job_.level_index < job_.num_levels_shuffle) break;
+
+            // 6. 记录纯 Shuffle 开销 (最后一层之外不含 insert)
+            if(!job_.last_level) record_stats();
+            // 7. 最终插入阶段：结果在 buffer_curr 中
+            job_.elements.swap(buffer_curr);
+            std::vector<Branch*>().swap(buffer_curr);
+            std::vector<Branch*>().swap(buffer_next);
+            table.assign(pow(2, HOTREE_level_), Entry());
+            stash.clear();
+            current_count = 0;
+            if(job_.reseed) client->UpdateSeed(seed_level_);
+            job_.cursor = 0;
+            job_.curr_id = 2147483647; // Sentinel value
+            job_.stage = ShuffleStage::Insert;
+            break;
         }
-
-        // 更新统计 (移出并行区)
-        client->communication_round_trip_ += (B / 2) / num_threads;
-        client->communication_volume_ += (B / 2) * 2 * Z * BlockSize * 2; 
-
-        // 交换 Buffer，准备下一轮
-        std::swap(buffer_curr, buffer_next);
-    }
-
-    // 6. 最终插入与去重阶段
-    // 此时结果存储在 buffer_curr 中
-    table.assign(pow(2, HOTREE_level_), Entry());
-    stash.clear();
-    current_count = 0;
-    client->UpdateSeed(HOTREE_level_);
-
-    int curr_id = 2147483647; // Sentinel value
-
-    for(Branch* branch : buffer_curr) {
-        if(branch != nullptr && !branch->is_dummy_for_shuffle) {
-            // 【保留】原有的去重逻辑
-            if(curr_id != branch->id) {
-                branch->level = HOTREE_level_;
-                branch->counter_for_lastest_data = 0;
-                
-                // 更新子节点元数据
-                for(auto & triple : branch->child_triple) {
-                    triple->counter_for_lastest_data = 0;
-                    triple->level = HOTREE_level_;
+        case ShuffleStage::Insert: {
+            size_t end = job_.cursor + std::min<long long>(budget, job_.elements.size() - job_.cursor);
+            budget -= end - job_.cursor;
+            for(; job_.cursor < end; job_.cursor++) {
+                Branch* branch = job_.elements[job_.cursor];
+                if(branch == nullptr || branch->is_dummy_for_shuffle) continue;
+                if(job_.dedup_on_insert) {
+                    if(job_.curr_id == branch->id) continue;
+                    job_.curr_id = branch->id;
+                }
+                if(job_.reset_on_insert) {
+                    if (branch->id == debug_id && if_is_debug) {
+                        printf("Inserting unique id %d with max counter %d in OHT.cpp\n", 
+                            branch->id, branch->counter_for_lastest_data);
+                    }
+                    branch->level = HOTREE_level_;
+                    branch->counter_for_lastest_data = 0;
+                    // child_triple 与读者可见的副本共享，由 HOTree 换层时统一归零
                 }
-                
                 insert(branch, client);
-                curr_id = branch->id;
-            }                
+            }
+            if(job_.cursor == job_.elements.size()) {
+                if(job_.record_stats && job_.last_level) record_stats();
+                // dummy_arena 与各 buffer 随 job 一起释放
+                job_ = ShuffleJob();
+            }
+            break;
+        }
+        case ShuffleStage::Idle:
+            break;
         }
     }
-
-    // 资源自动清理：
-    // dummy_arena 和 buffer vectors 会在此处析构
-    // 无需手动 delete 循环
+    job_.elapsed_ms = elapsed_ms();
+    return job_.stage == ShuffleStage::Idle;
 }
 
 // void CuckooTable::oblivious_shuffle_and_insert(std::vector<Branch*>& all_elements_before_otc, std::vector<int> branchs_level_belong_to, Client* client) {
@@ -846,7 +749,7 @@ void CuckooTable::oblivious_shuffle(Client* client) {
     table.assign(table.size(), Entry());
     stash.clear();
     current_count = 0;
-    client->UpdateSeed(HOTREE_level_);
+    client->UpdateSeed(seed_level_);
 
     for(int i = 0; i < B; i++) {
         for(auto* branch : memory[num_levels_shuffle][i]) {
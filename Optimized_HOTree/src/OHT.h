@@ -3,6 +3,7 @@
 #include <cstddef>
 #include <omp.h>
 #include <chrono>
+#include <unordered_map>
 #include "Branch.h"
 #include "define.h"
 #include "client.h"
@@ -22,10 +23,15 @@ public:
     size_t capacity() const { return table.size(); }
 
     void oblivious_shuffle(Client* client);
-    void oblivious_shuffle_and_insert_last_level(std::vector<Branch*>& all_elements, std::vector<int> branchs_level_belong_to, Client* client);
     // 修改：处理指针向量
     void oblivious_shuffle_and_insert(std::vector<Branch*>& all_elements, std::vector<int> branchs_level_belong_to, Client* client);
-    std::vector<Branch*> oblivious_tight_compaction(std::vector<Branch*> all_elements, std::vector<int> branchs_level_belong_to, Client* client);
+    // 分步版本：begin 只清空表并记录输入 (接管 all_elements)，step 每次最多推进 work_units 个工作单元，
+    // 全部完成 (表已可用) 时返回 true。一个单元 = butterfly 中的一对桶，其它阶段按同等规模 (2Z 个块) 切分
+    // reseed 为 false 时不更新种子：调用方已在写锁下为 seed_level_ 换好种子 (后台重建)，step 不再改动 Client 的共享状态。
+    // parallel 为 false 时各阶段串行执行 (在持读锁的查询线程里分步推进时，不嵌套 OpenMP 线程组)
+    void begin_shuffle_and_insert(std::vector<Branch*>& all_elements, std::vector<int> branchs_level_belong_to, Client* client, bool reseed = true);
+    bool step_shuffle_and_insert(long long work_units, Client* client, bool parallel = true);
+    bool shuffle_pending() const { return job_.stage != ShuffleStage::Idle; }
 
 public:
     struct Entry {
@@ -38,12 +44,39 @@ public:
     const size_t STASH_CAPACITY = cuckoo_stash_size;
     size_t current_count;
     int HOTREE_level_;
+    // 计算 cuckoo 位置所用的种子槽位，通常等于 HOTREE_level_；
+    // 后台重建时指向 Client 的暂存槽位，换层后再改回 HOTREE_level_
+    size_t seed_level_;
     double single_shuffle_round_trips;
     double single_shuffle_commucations;
     double single_shuffle_times;
     int shuffle_count;
     bool shuffle_tested_flag = false;
 
+    // 未完成的 shuffle & insert，各阶段都可以在任意单元边界暂停
+    enum class ShuffleStage { Idle, Compact, Decrypt, Fill, Butterfly, Insert };
+    struct ShuffleJob {
+        ShuffleStage stage = ShuffleStage::Idle;
+        bool record_stats = false;     // 首次真实 shuffle：结束时写入 single_shuffle_*
+        bool last_level = false;       // 顶层：butterfly 用 last_level 版本
+        bool dedup_on_insert = false;  // 插入时跳过与前一个相同 id 的旧版本 (顶层 butterfly 输出按 id 有序)
+        bool reset_on_insert = false;  // 顶层：插入前把计数器归零、层号设为本层
+        bool reseed = true;            // butterfly 结束、插入前重新生成 cuckoo 种子
+        std::vector<Branch*> elements; // Compact/Decrypt/Insert 阶段的输入
+        std::vector<int> belong;
+        std::unordered_map<int, Branch*> unique_elements;
+        std::vector<Branch*> buffer_curr, buffer_next;
+        std::vector<Branch> dummy_arena;
+        int N_real = 0, B = 0, num_levels_shuffle = 0;
+        int level_index = 0;           // butterfly 当前层
+        int next_pair = 0;             // butterfly 当前层下一对桶 / Fill 阶段下一个桶
+        size_t cursor = 0;             // Compact/Decrypt/Insert 阶段的位置
+        int data_idx = 0;
+        int curr_id = 2147483647;
+        double volume = 0, round_trips = 0, elapsed_ms = 0;
+    };
+    ShuffleJob job_;
+
     static const int MAX_KICKS = 500;
 
     size_t hash(uint64_t id, size_t seed) const;
@@ -79,9 +112,9 @@ public:
                 if (!b->child_triple.empty()) {
                     std::cout << "         └── Children: ";
                     for (size_t j = 0; j < b->child_triple.size(); ++j) {
-                        Triple* t = b->child_triple[j];
+                        Triple* t = b->child_triple[j].get();
                         if (t != nullptr) {
-                            std::cout << "[ID:" << t->id << ", C:" << t->counter_for_lastest_data << ", L:" << t->level << "]";
+                            std::cout << "[ID:" << t->id << ", C:" << t->counter() << ", L:" << t->level() << "]";
                         } else {
                             std::cout << "[NULL]";
                         }
@@ -105,8 +138,8 @@ public:
                     // 同样展开 Stash 节点的子节点
                     if (!sb->child_triple.empty()) {
                         std::cout << "           └── Children: ";
-                        for (auto* st : sb->child_triple) {
-                            if (st) std::cout << "[ID:" << st->id << ", C:" << st->counter_for_lastest_data << ", L:" << st->level << "] ";
+                        for (auto& st : sb->child_triple) {
+                            if (st) std::cout << "[ID:" << st->id << ", C:" << st->counter() << ", L:" << st->level() << "] ";
                         }
                         std::cout << std::endl;
                     }
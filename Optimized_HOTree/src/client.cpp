@@ -2,7 +2,7 @@
 #include <random>
 
 Client::Client(int L) 
-    : current_total_stash_size_(0), gen(global_seed), dis(0, 0xFFFFFFFF) 
+    : stash_(2 * background_stash_limit), gen(global_seed), dis(0, 0xFFFFFFFF) 
 {
     
     cryptor_ = new Cryptor(L);
@@ -25,15 +25,13 @@ Client::Client(int L)
         }
     }
     seed_shuffle_ = dis(gen);
+    vec_seed1_.push_back(dis(gen)); // staging slot (see staging_seed_level)
+    vec_seed2_.push_back(dis(gen));
     vector_every_level_stash_.resize(L+1);
 
     /*------------------------------------------for inter-query parallelism--------------------------------------------------*/
     num_users_ = num_users;
-    user_stashes_.resize(num_users_);
-    user_stash_mtxs_.reserve(num_users_); // reserve 避免 realloc
-    for(int i = 0; i < num_users_; ++i) {
-        user_stash_mtxs_.push_back(std::make_unique<std::mutex>());
-    }
+    stash_shards_ = std::make_unique<StashShard[]>(num_users_);
 
     // 初始化 Level Stash 锁
     vector_every_level_stash_.resize(L + 1);
@@ -82,6 +80,11 @@ void Client::UpdateSeed(size_t level_i) {
     vec_seed2_[level_i] = dis(gen);
 }
 
+void Client::CommitStagedSeed(size_t level_i) {
+    vec_seed1_[level_i] = vec_seed1_[staging_seed_level()];
+    vec_seed2_[level_i] = vec_seed2_[staging_seed_level()];
+}
+
 // src/client.cpp
 Client::~Client() {
     delete cryptor_;
@@ -92,13 +95,26 @@ Client::~Client() {
     }
     vector_every_level_stash_.clear();
     /*------------------------------------------for inter-query parallelism--------------------------------------------------*/
-    for(auto& map : user_stashes_) {
-        // 注意：Branch* 的内存管理需要明确，这里假设在 Eviction 或其他地方处理
-        map.clear();
-    }
+    // 注意：Branch* 的内存管理需要明确，这里假设在 Eviction 或其他地方处理
+    stash_.clear();
+    evicting_stash_.clear();
     /*------------------------------------------for inter-query parallelism--------------------------------------------------*/
 }
 
+int Client::stash_size() const {
+    int total = 0;
+    for(int i = 0; i < num_users_; ++i) {
+        total += stash_shards_[i].count.load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+void Client::reset_stash_size() {
+    for(int i = 0; i < num_users_; ++i) {
+        stash_shards_[i].count.store(0, std::memory_order_relaxed);
+    }
+}
+
 int Client::get_first_empty_level() {
     int result_level;
     for(int level_i = min_level_; level_i <= max_level_; level_i++) {
@@ -177,7 +193,8 @@ void Client::ObliviousMergeSplit(
     std::vector<Branch*>& bucket_out_1,
     int level_index,
     int num_levels_shuffle,
-    int HOTREE_level
+    int HOTREE_level,
+    bool parallel
 ) {
     // 1. 定义静态 Dummy，避免频繁 new/delete
     static Branch dummy_branch(true, true);
@@ -189,10 +206,10 @@ void Client::ObliviousMergeSplit(
     // ============================================================
     // 第一阶段：并行解密 (必须严格保护共享的 dummy 节点)
     // ============================================================
-    omp_set_num_threads(num_threads);
+    // 线程数由 num_threads 子句指定，不改调用线程的全局设置；parallel 为 false 时串行执行
 
     // 处理 bucket_in_0
-    #pragma omp parallel for
+    #pragma omp parallel for num_threads(num_threads) if(parallel)
     for(size_t i = 0; i < bucket_in_0.size(); ++i) {
         Branch* s = bucket_in_0[i];
         // 核心修复：先判断是否为空或 Dummy，绝对不能对共享 Dummy 进行写操作！
@@ -202,7 +219,7 @@ void Client::ObliviousMergeSplit(
     }
 
     // 处理 bucket_in_1
-    #pragma omp parallel for
+    #pragma omp parallel for num_threads(num_threads) if(parallel)
     for(size_t i = 0; i < bucket_in_1.size(); ++i) {
         Branch* s = bucket_in_1[i];
         // 核心修复：同上
@@ -235,7 +252,7 @@ void Client::ObliviousMergeSplit(
     // 第三阶段：并行加密 (同样跳过 dummy)
     // ============================================================
     // pool 中只包含非 dummy 元素，所以这里可以直接并行加密
-    #pragma omp parallel for
+    #pragma omp parallel for num_threads(num_threads) if(parallel)
     for(size_t i = 0; i < pool.size(); ++i) {
         Branch* elem = pool[i];
         elem->trueData = cryptor_->aes_encrypt(elem->trueData, HOTREE_level);
@@ -450,7 +467,8 @@ void Client::ObliviousMergeSplit_firstlevel_last_level(
     std::vector<Branch*>& bucket_out_1,
     int level_index,        // 在新逻辑中不再使用，但为了保持接口兼容保留
     int num_levels_shuffle, // 在新逻辑中不再使用，但为了保持接口兼容保留
-    int HOTREE_level
+    int HOTREE_level,
+    bool parallel
 ) {
     // 1. 定义静态 Dummy，避免频繁 new/delete，且保证所有 Dummy 指向同一地址
     static Branch dummy_branch(true, true);
@@ -465,7 +483,7 @@ void Client::ObliviousMergeSplit_firstlevel_last_level(
     // 注意：std::sort 需要读取明文 ID。如果 bucket_in 中的数据是密文，
     // 请确保在放入 pool 之前或在此处调用 aes_decrypt。
     // 假设输入数据在此阶段 ID 是可读的。
-    omp_set_num_threads(num_threads);
+    // 线程数由下面并行区的 num_threads 子句指定；parallel 为 false 时串行执行
 
     // ============================================================
     // 第二阶段：串行收集 Real 元素 (过滤掉 Dummy)
@@ -506,7 +524,7 @@ void Client::ObliviousMergeSplit_firstlevel_last_level(
     // 第四阶段：并行加密 (只加密 Real 元素)
     // ============================================================
     // 排序后，pool 中的元素顺序已定，现在并行更新它们的密文
-    #pragma omp parallel for
+    #pragma omp parallel for num_threads(num_threads) if(parallel)
     for(size_t i = 0; i < pool.size(); ++i) {
         Branch* elem = pool[i];
         // 重新加密数据块
@@ -2,6 +2,7 @@
 #include "cryptor.h"
 #include "define.h"
 #include "Branch.h"
+#include "stash.h"
 #include <vector>
 #include <unordered_map>
 
@@ -20,18 +21,26 @@ public:
     std::vector<std::mt19937> user_gens_;
     std::uniform_int_distribution<uint32_t> dis;
 
-    // --- 基于用户的 Stash 结构 ---
-    // user_stashes_[i] 是第 i 个用户的专属 stash
+    // --- Stash 结构 ---
+    // 所有用户共享一张无锁 stash ("ID检测机制" 只需查一次)，驱逐时在写锁下整体取出
     int num_users_; 
-    std::vector<std::unordered_map<int, Branch*>> user_stashes_;
-    
-    // 尽管每个用户写自己的 stash，但因为有“ID检测机制”（别人要读），所以还是需要锁
-    std::vector<std::unique_ptr<std::mutex>> user_stash_mtxs_;
-    
-    // 全局原子计数器：所有用户的 stash 元素总和
-    std::atomic<int> current_total_stash_size_{0};
+    ConcurrentStash stash_;
+
+    // 分片计数器：每个用户只累加自己的分片 (独占缓存行)，
+    // 每 stash_trigger_stride 次插入才汇总一次判断是否需要驱逐
+    struct alignas(64) StashShard {
+        std::atomic<int> count{0};
+    };
+    std::unique_ptr<StashShard[]> stash_shards_;
+    int stash_size() const;
+    void reset_stash_size();
     std::vector<std::unique_ptr<std::mutex>> level_stash_mtxs_;
 
+    // 后台重建 (EvictionMode::Background) 期间的快照 stash：
+    // 触发驱逐时所有用户 stash 被整体移入这里，由后台线程克隆后重建目标层。
+    // 只在写锁下修改，读者 (持读锁) 可无锁按 id 查找，命中后拷贝一份到自己的 stash
+    std::unordered_map<int, Branch*> evicting_stash_;
+
     /*------------------------------------------for inter-query parallelism--------------------------------------------------*/
     std::vector<size_t> vec_seed1_; // save the 1st hash seed every level
     std::vector<size_t> vec_seed2_; // save the 2nd hash seed every level
@@ -66,7 +75,8 @@ public:
         std::vector<Branch*>& bucket_out_1,
         int level_index,
         int num_levels_shuffle,
-        int HOTREE_level
+        int HOTREE_level,
+        bool parallel = true   // false：在查询线程里分步执行，不开 OpenMP 线程组
     );
     void ObliviousMergeSplit_firstlevel(
         std::vector<Branch*>& bucket_in_0,
@@ -93,9 +103,14 @@ public:
         std::vector<Branch*>& bucket_out_1,
         int level_index,
         int num_levels_shuffle,
-        int HOTREE_level
+        int HOTREE_level,
+        bool parallel = true   // false：在查询线程里分步执行，不开 OpenMP 线程组
     );
     void UpdateSeed(size_t level_i);
+    // 种子向量末尾多留一个暂存槽位：后台重建的新表用它插入，换层时再提交到真实层号，
+    // 这样重建过程中读者看到的仍是旧表的种子
+    size_t staging_seed_level() const { return vec_seed1_.size() - 1; }
+    void CommitStagedSeed(size_t level_i);
     // 生成随机数的函数
     int getRandomIndex(int range, int user_id) {
         // 使用对应线程的 generator，完全无锁且安全
@@ -42,6 +42,27 @@ constexpr const int child_debug_id = -18;
 constexpr const int global_seed = 200;
 constexpr const int if_is_debug = 0;
 
+// Eviction 模式：
+//   StopTheWorld : 原始做法，stash 满时持写锁同步完成整个 oblivious shuffle
+//   Background   : 去摊销 (deamortized)，stash 快照交给后台线程重建目标层，
+//                  期间读者继续访问旧层 + 快照 stash，重建完成后持写锁短暂换层
+//   Incremental  : 与 Background 相同的快照/换层流程，但不开线程 (enclave 的 TCS 数有限)，
+//                  由每次 Retrieve 推进固定数量的工作单元 (butterfly 的一对桶)
+enum class EvictionMode { StopTheWorld, Background, Incremental };
+constexpr const EvictionMode default_eviction_mode = EvictionMode::Background;
+// 重建尚未完成时，用户 stash 可以继续增长到的上限；超过后才等待重建结束。
+// 顶层重建远慢于 stash 填满 Z 的速度，这里用客户端内存换取查询不被阻塞
+constexpr const int background_stash_limit = 4*Z;
+// Incremental 模式：每 incremental_step_interval 次 Retrieve 推进 incremental_units_per_step 个工作单元
+// (一个单元 = 2Z 个块)。顶层重建约 (B/2)*(log2(B)+3) 个单元，B = 2N/Z；
+// 按下面的节奏，N 在 Z*Z/64 量级以内时都能在 stash 涨到 background_stash_limit 之前完成
+constexpr const int incremental_units_per_step = 1;
+constexpr const int incremental_step_interval = 16;
+// 每个用户每插入这么多个节点才汇总一次各分片的 stash 计数，驱逐最多晚 num_users * stride 个节点触发
+constexpr const int stash_trigger_stride = 32;
+// Retrieve 在各处都没找到节点时，等待并发用户把它发布到共享 stash 的最大重试次数
+constexpr const int stash_retry_limit = 1 << 16;
+
 
 // --- 2. 数据结构定义 ---
 struct DataRecord {
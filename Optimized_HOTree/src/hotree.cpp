@@ -8,6 +8,9 @@ using namespace std;
 // }
 
 #include <unordered_set>
+#include <limits>
+#include <atomic>
+#include <stdexcept>
 
 void HOTree::PerformGarbageCollection(int target_level) {
     // 1. 只有在最后一层（最大层）才进行清理
@@ -35,6 +38,10 @@ void HOTree::PerformGarbageCollection(int target_level) {
         }
     }
 
+    // 用户 stash 中的节点仍在使用
+    // (同步驱逐时它已为空；后台重建换层时用户 stash 里是重建期间新取回的数据)
+    client_->stash_.for_each([&](int id, Branch* ptr) { active_pointers.insert(ptr); });
+
     // 3. [Sweep 阶段] 遍历全局池，保留活的，删除死的
     std::vector<Branch*> survivors;
     survivors.reserve(active_pointers.size());
@@ -46,18 +53,50 @@ void HOTree::PerformGarbageCollection(int target_level) {
         } 
         // 否则，它是 Compaction 丢弃的旧版本或重复数据，彻底删除！
         else {
-            delete ptr; 
+            RetireBranch(ptr);
         }
     }
 
     // 4. 更新 all_branchs 为幸存者列表
     all_branchs = std::move(survivors);
+    ReclaimRetiredBranchs();
 
     if (if_is_debug) {
         std::cout << "[GC] End Garbage Collection. After: " << all_branchs.size() << " objects." << std::endl;
     }
 }
 
+// 以下两个函数只在写锁下调用。挂起的节点记下当前 epoch，之后开始的查询拿到更大的 epoch，
+// 不会再从表 / stash 中取到它们
+void HOTree::RetireBranch(Branch* branch) {
+    retired_branchs_.push_back({reclaim_epoch_.load(), branch});
+}
+
+void HOTree::ReclaimRetiredBranchs() {
+    uint64_t current = reclaim_epoch_.fetch_add(1) + 1;
+    // 从上次的位置往后找第一个仍有查询登记的 epoch；写锁下没有查询在登记，计数不会增加
+    while (oldest_active_epoch_ < current && active_queries_[oldest_active_epoch_ % kEpochSlots].load() == 0) {
+        oldest_active_epoch_++;
+    }
+    size_t kept = 0;
+    for (auto& [epoch, branch] : retired_branchs_) {
+        if (epoch < oldest_active_epoch_) delete branch;
+        else retired_branchs_[kept++] = {epoch, branch};
+    }
+    retired_branchs_.resize(kept);
+}
+
+// 查询开始时在读锁下登记 (持读锁时 epoch 不会前进)，结束时注销，返回登记的 epoch
+uint64_t HOTree::EnterQueryEpoch() {
+    uint64_t epoch = reclaim_epoch_.load();
+    active_queries_[epoch % kEpochSlots].fetch_add(1);
+    return epoch;
+}
+
+void HOTree::ExitQueryEpoch(uint64_t epoch) {
+    active_queries_[epoch % kEpochSlots].fetch_sub(1);
+}
+
 void HOTree::clear_additional_oblivious_shuffle_time() {
     for(int i = client_->min_level_; i <= client_->max_level_; i++) {
         vec_hashtable_[i]->shuffle_count = 0;
@@ -91,8 +130,8 @@ void HOTree::findid(int target_id) {
                           << ", Counter: " << entry.branch->counter_for_lastest_data << std::endl;
                 for(auto & triple : entry.branch->child_triple) {
                     std::cout<<" child id "<< triple->id
-                             <<" child level "<<triple->level
-                             <<" child counter "<< triple->counter_for_lastest_data<<std::endl;
+                             <<" child level "<<triple->level()
+                             <<" child counter "<< triple->counter()<<std::endl;
                 }
             }
         }
@@ -105,8 +144,8 @@ void HOTree::findid(int target_id) {
                           << ", Counter: " << branch_ptr->counter_for_lastest_data << std::endl;
                 for(auto & triple : branch_ptr->child_triple) {
                     std::cout<<" child id "<< triple->id
-                             <<" child level "<<triple->level
-                             <<" child counter "<< triple->counter_for_lastest_data<<std::endl;
+                             <<" child level "<<triple->level()
+                             <<" child counter "<< triple->counter()<<std::endl;
                 }
             }
         }
@@ -119,8 +158,8 @@ void HOTree::findid(int target_id) {
                           << ", Counter: " << branch_ptr->counter_for_lastest_data << std::endl;
                 for(auto & triple : branch_ptr->child_triple) {
                     std::cout<<" child id "<< triple->id
-                             <<" child level "<<triple->level
-                             <<" child counter "<< triple->counter_for_lastest_data<<std::endl;
+                             <<" child level "<<triple->level()
+                             <<" child counter "<< triple->counter()<<std::endl;
                 }
             }
         }
@@ -141,6 +180,19 @@ HOTree::HOTree(const vector<string>& dict){
 }
 
 HOTree::~HOTree() {
+    // 后台重建线程还在运行时先等它结束，它会访问 all_branchs 与各层表；
+    // 未换层的旧表节点已从 all_branchs 移出，需要单独释放
+    if (rebuild_thread_.joinable()) rebuild_thread_.join();
+    if (rebuild_in_flight_ && !rebuild_input_ready_) {
+        // 分步重建还没把克隆登记到 all_branchs：克隆单独释放，旧表原节点仍归 all_branchs 所有
+        for (auto* b : rebuild_input_) delete b;
+        for (auto* b : rebuild_level_stash_) delete b;
+        rebuild_retired_.clear();
+    }
+    for (auto* b : rebuild_retired_) delete b;
+    rebuild_retired_.clear();
+    for (auto& [epoch, b] : retired_branchs_) delete b;
+    retired_branchs_.clear();
     
     // 修改后：让 Branch 的析构函数自己负责 Triple 的清理
     for (auto* b : all_branchs) {
@@ -221,36 +273,19 @@ void HOTree::Eviction(Client* client) {
             branchs_level_belong_to.push_back(target_level);
         }
         client_->vector_every_level_stash_[target_level].clear();
-
-        for(auto & triple : root) {
-            triple->level = target_level;
-            triple->counter_for_lastest_data = 0;
-        }
     }
     client->vec_hotree_level_i_is_empty_[target_level] = false; // level_i will be full
 
     /*-------------------------Move data of client stash to a vector-------------------------------*/
-    for(int i = 0; i < client->num_users_; ++i) {
-        auto& stash = client->user_stashes_[i];
-        for(auto& [id, branch] : stash) {
-             // 加密并加入 shuffle 队列
-             branch->trueData = client->cryptor_->aes_encrypt(branch->trueData, target_level);
-             branch->level = target_level;
-             all_shuffled_branchs.push_back(branch);
-             branchs_level_belong_to.push_back(target_level);
-        }
-        stash.clear(); // 清空 map
-    }
+    client->stash_.for_each([&](int id, Branch* branch) {
+        // 加密并加入 shuffle 队列
+        branch->trueData = client->cryptor_->aes_encrypt(branch->trueData, target_level);
+        branch->level = target_level;
+        all_shuffled_branchs.push_back(branch);
+        branchs_level_belong_to.push_back(target_level);
+    });
+    client->stash_.clear();
 
-    /*-------------------------update prediction level of all data-------------------------------*/
-    for(auto & branch : all_shuffled_branchs) {
-        for(auto & triple : branch->child_triple) {
-            if(triple->level < target_level) {
-                triple->level = target_level;
-            }
-        }
-    }
-    
     /*-------------------------oblivious shuffle-------------------------------*/
     vec_hashtable_[target_level]->oblivious_shuffle_and_insert(all_shuffled_branchs, branchs_level_belong_to, client); // this fuction includes updating hash seed. 
     
@@ -262,6 +297,9 @@ void HOTree::Eviction(Client* client) {
         client_->vector_every_level_stash_[target_level].push_back(temp_branch);
     }
     vec_hashtable_[target_level]->stash.clear();
+
+    /*-------------------------update prediction level of all data-------------------------------*/
+    SettleTriples(target_level, client);
     
     if(target_level == client->max_level_) {
         //This function promptly frees variables to prevent memory explosion. However, it incurs a performance overhead
@@ -279,6 +317,276 @@ void HOTree::Eviction(Client* client) {
     }
 }
 
+/*
+Deamortized eviction (EvictionMode::Background / EvictionMode::Incremental).
+Begin (write lock held): snapshot the user stashes into client->evicting_stash_ and clone the level stashes of the
+levels to merge, then hand the rebuild of the target level to a background thread (Background) or leave it pending
+(Incremental). Readers keep using the old levels plus the snapshot stash, and new retrievals go to the emptied user
+stashes.
+StepRebuild (background thread, or a few units per Retrieve): clone the old level data and the snapshot, oblivious
+shuffle into a private table that uses the staging seed slot. Its seeds are drawn at Begin; steps taken from a query
+thread run serially.
+Commit (write lock held): swap the new table in, clear the merged levels and drop the snapshot.
+*/
+void HOTree::BeginBackgroundEviction(Client* client) {
+    // 上一次重建还没换层：只有 stash 涨到 background_stash_limit 时重建仍未完成才会在这里等待
+    if (rebuild_in_flight_) {
+        CommitBackgroundEviction(client);
+    }
+    int target_level = client->get_first_empty_level();
+    rebuild_target_level_ = target_level;
+    rebuild_source_levels_.clear();
+    rebuild_stash_.clear();
+    rebuild_retired_.clear();
+    rebuild_level_stash_.clear();
+    rebuild_level_stash_belong_to_.clear();
+
+    /*-------------------------levels to merge; their level stashes are mutated by readers, so clone them here-------------------------------*/
+    for(int level_i = client->min_level_; level_i < target_level; level_i++) {
+        if(!client->vec_hotree_level_i_is_empty_[level_i]) rebuild_source_levels_.push_back(level_i);
+    }
+    // if it is the greatest level, merge it and upper levels
+    if(target_level == client->max_level_) rebuild_source_levels_.push_back(target_level);
+    for(int level_i : rebuild_source_levels_) {
+        std::lock_guard<std::mutex> lg(*client->level_stash_mtxs_[level_i]);
+        for(auto* elem : client->vector_every_level_stash_[level_i]) {
+            rebuild_level_stash_.push_back(new Branch(elem));
+            rebuild_level_stash_belong_to_.push_back(level_i);
+        }
+    }
+
+    /*-------------------------move the client stash into the snapshot stash-------------------------------*/
+    client->stash_.for_each([&](int id, Branch* branch) {
+        rebuild_stash_.push_back(branch);
+        auto it = client->evicting_stash_.find(id);
+        if(it == client->evicting_stash_.end() || branch->counter_for_lastest_data > it->second->counter_for_lastest_data) {
+            client->evicting_stash_[id] = branch;
+        }
+    });
+    client->stash_.clear();
+    client->reset_stash_size();
+
+    rebuild_table_ = make_unique<CuckooTable>(pow(2, target_level), target_level);
+    rebuild_table_->seed_level_ = client->staging_seed_level();
+    // 新种子 (cuckoo 位置与 shuffle 路由) 在写锁下生成，重建过程中不再改动 Client 的共享状态
+    client->UpdateSeed(client->staging_seed_level());
+    // 沿用原表的 shuffle 计时缓存，保持 compute_additional_oblivious_shuffle_time 的统计口径
+    rebuild_table_->shuffle_tested_flag = vec_hashtable_[target_level]->shuffle_tested_flag;
+    rebuild_table_->shuffle_count = vec_hashtable_[target_level]->shuffle_count;
+    rebuild_table_->single_shuffle_times = vec_hashtable_[target_level]->single_shuffle_times;
+    rebuild_table_->single_shuffle_round_trips = vec_hashtable_[target_level]->single_shuffle_round_trips;
+    rebuild_table_->single_shuffle_commucations = vec_hashtable_[target_level]->single_shuffle_commucations;
+
+    rebuild_input_.clear();
+    rebuild_input_belong_to_.clear();
+    rebuild_clone_level_ = 0;
+    rebuild_clone_pos_ = 0;
+    rebuild_input_ready_ = false;
+    rebuild_access_count_.store(0);
+    rebuild_in_flight_ = true;
+    rebuild_ready_.store(false);
+    if (eviction_mode_ == EvictionMode::Background) {
+        rebuild_thread_ = std::thread(&HOTree::RunBackgroundEviction, this, client);
+    }
+}
+
+void HOTree::RunBackgroundEviction(Client* client) {
+    StepRebuild(client, std::numeric_limits<long long>::max());
+}
+
+// Advance the pending rebuild by at most work_units units (one unit = 2Z blocks, i.e. one butterfly bucket pair).
+// Returns true once rebuild_table_ is complete; rebuild_ready_ is set at the same time.
+bool HOTree::StepRebuild(Client* client, long long work_units, bool parallel) {
+    if (rebuild_ready_.load()) return true;
+    int target_level = rebuild_target_level_;
+    const long long unit = 2LL * Z;
+    long long budget = (work_units > std::numeric_limits<long long>::max() / unit) ?
+        std::numeric_limits<long long>::max() : work_units * unit;
+
+    // 输入都是私有克隆；它们的 triple 与读者可见的副本共享，换层时才在写锁下更新 (SettleTriples)
+    auto add_input = [&](Branch* branch, int belong_to) {
+        branch->level = target_level;
+        rebuild_input_.push_back(branch);
+        rebuild_input_belong_to_.push_back(belong_to);
+    };
+
+    // 旧层与快照在换层前仍被读者访问，这里只读取并克隆，shuffle 在克隆上进行
+    while(!rebuild_input_ready_ && rebuild_clone_level_ < rebuild_source_levels_.size()) {
+        if(budget <= 0) return false;
+        int level_i = rebuild_source_levels_[rebuild_clone_level_];
+        auto& table = vec_hashtable_[level_i]->table;
+        size_t end = rebuild_clone_pos_ + std::min<long long>(budget, table.size() - rebuild_clone_pos_);
+        budget -= end - rebuild_clone_pos_;
+        for(; rebuild_clone_pos_ < end; rebuild_clone_pos_++) {
+            auto& entry = table[rebuild_clone_pos_];
+            if(entry.occupied) {
+                rebuild_retired_.push_back(entry.branch);
+                add_input(new Branch(entry.branch), level_i);
+            }
+        }
+        if(rebuild_clone_pos_ == table.size()) {
+            rebuild_clone_level_++;
+            rebuild_clone_pos_ = 0;
+        }
+        if(rebuild_clone_level_ == rebuild_source_levels_.size()) {
+            // level stash 很小 (受 cuckoo stash 约束)，随最后一个旧层一起并入
+            for(size_t i = 0; i < rebuild_level_stash_.size(); i++) {
+                Branch* elem = rebuild_level_stash_[i];
+                if(rebuild_level_stash_belong_to_[i] != target_level) {
+                    elem->trueData = client->cryptor_->aes_encrypt(elem->trueData, target_level);
+                }
+                add_input(elem, rebuild_level_stash_belong_to_[i]);
+            }
+            rebuild_level_stash_.clear();
+            rebuild_level_stash_belong_to_.clear();
+        }
+    }
+    while(!rebuild_input_ready_ && rebuild_clone_pos_ < rebuild_stash_.size()) {
+        if(budget <= 0) return false;
+        size_t end = rebuild_clone_pos_ + std::min<long long>(budget, rebuild_stash_.size() - rebuild_clone_pos_);
+        budget -= end - rebuild_clone_pos_;
+        for(; rebuild_clone_pos_ < end; rebuild_clone_pos_++) {
+            Branch* clone = new Branch(rebuild_stash_[rebuild_clone_pos_]);
+            clone->trueData = client->cryptor_->aes_encrypt(clone->trueData, target_level);
+            add_input(clone, target_level);
+        }
+    }
+    if(!rebuild_input_ready_) {
+        if(budget <= 0) return false;
+        {
+            // 表中的原节点只会被读者拷贝、不会被持有，换层后即可释放：先把所有权从 all_branchs 中移出
+            std::unordered_set<Branch*> retired(rebuild_retired_.begin(), rebuild_retired_.end());
+            std::lock_guard<std::mutex> lock(all_branchs_mtx_);
+            all_branchs.erase(std::remove_if(all_branchs.begin(), all_branchs.end(),
+                                             [&](Branch* b) { return retired.count(b) != 0; }),
+                              all_branchs.end());
+            all_branchs.insert(all_branchs.end(), rebuild_input_.begin(), rebuild_input_.end());
+        }
+        budget -= unit;
+        rebuild_table_->begin_shuffle_and_insert(rebuild_input_, std::move(rebuild_input_belong_to_), client, false);
+        rebuild_input_.clear();
+        rebuild_input_belong_to_.clear();
+        rebuild_input_ready_ = true;
+        if(budget <= 0) return false;
+    }
+
+    // 剩余预算换算成 shuffle 的工作单元 (向上取整，最多多做一个单元)
+    long long units = (budget == std::numeric_limits<long long>::max()) ? budget : (budget + unit - 1) / unit;
+    if(!rebuild_table_->step_shuffle_and_insert(units, client, parallel)) return false;
+    rebuild_ready_.store(true);
+    return true;
+}
+
+void HOTree::CommitBackgroundEviction(Client* client) {
+    if (!rebuild_in_flight_) return;
+    if (rebuild_thread_.joinable()) {
+        rebuild_thread_.join();
+    } else {
+        // Incremental：stash 涨到上限时重建仍未完成，在写锁下把剩余的单元一次做完
+        StepRebuild(client, std::numeric_limits<long long>::max());
+    }
+    int target_level = rebuild_target_level_;
+
+    for(int level_i : rebuild_source_levels_) {
+        if(level_i == target_level) continue;
+        vec_hashtable_[level_i]->table.clear();
+        client->vector_every_level_stash_[level_i].clear();
+        client->vec_hotree_level_i_is_empty_[level_i] = true;
+    }
+    client->vector_every_level_stash_[target_level].clear();
+
+    /*-------------------------swap the new table in-------------------------------*/
+    client->CommitStagedSeed(target_level);
+    rebuild_table_->seed_level_ = target_level;
+    vec_hashtable_[target_level] = std::move(rebuild_table_);
+    client->vec_hotree_level_i_is_empty_[target_level] = false;
+    for(int i = 0; i < vec_hashtable_[target_level]->stash.size(); i++) {
+        Branch* temp_branch = vec_hashtable_[target_level]->stash[i];
+        temp_branch->trueData = client->cryptor_->aes_decrypt(temp_branch->trueData, target_level);
+        client->vector_every_level_stash_[target_level].push_back(temp_branch);
+    }
+    vec_hashtable_[target_level]->stash.clear();
+    SettleTriples(target_level, client);
+    for(Branch* branch : rebuild_retired_) RetireBranch(branch);
+    rebuild_retired_.clear();
+
+    // 快照 stash 中的原节点已被克隆进新表；跨越快照的查询可能仍持有它们，交给 epoch 回收
+    // (仍挂在某个 level stash 或 client stash 里的节点除外)
+    {
+        std::unordered_set<Branch*> referenced;
+        for(auto& level_stash : client->vector_every_level_stash_) referenced.insert(level_stash.begin(), level_stash.end());
+        client->stash_.for_each([&](int id, Branch* branch) { referenced.insert(branch); });
+        std::unordered_set<Branch*> dead;
+        for(Branch* branch : rebuild_stash_) {
+            if(!referenced.count(branch)) dead.insert(branch);
+        }
+        all_branchs.erase(std::remove_if(all_branchs.begin(), all_branchs.end(),
+                                         [&](Branch* b) { return dead.count(b) != 0; }),
+                          all_branchs.end());
+        for(Branch* branch : dead) RetireBranch(branch);
+    }
+    client->evicting_stash_.clear();
+    rebuild_stash_.clear();
+    if(target_level == client->max_level_) {
+        PerformGarbageCollection(target_level);
+    } else {
+        ReclaimRetiredBranchs();
+    }
+    rebuild_level_stash_.clear();
+    rebuild_level_stash_belong_to_.clear();
+    rebuild_source_levels_.clear();
+    rebuild_input_ready_ = false;
+    rebuild_in_flight_ = false;
+    rebuild_ready_.store(false);
+}
+
+// 换层后 (写锁下) 更新所有 triple：并入目标层的孩子改指目标层，顶层重建还把计数器归零。
+// triple 在父节点的各个副本间共享，遍历目标层与 client stash 中的父节点、以及 root 即可覆盖全部父子边；
+// 仍在 client stash 中的孩子 (后台重建期间取回) 已由 Retrieve 指向下一次驱逐的层，保持不变
+void HOTree::SettleTriples(int target_level, Client* client) {
+    bool top = (target_level == client->max_level_);
+    auto settle = [&](const std::shared_ptr<Triple>& triple) {
+        if(client->stash_.find(triple->id) != nullptr) return;
+        if(top) triple->store(target_level, 0);
+        else triple->raise_level(target_level);
+    };
+    for(const auto& entry : vec_hashtable_[target_level]->table) {
+        if(!entry.occupied || entry.branch == nullptr) continue;
+        for(const auto& triple : entry.branch->child_triple) settle(triple);
+    }
+    for(Branch* branch : client->vector_every_level_stash_[target_level]) {
+        for(const auto& triple : branch->child_triple) settle(triple);
+    }
+    client->stash_.for_each([&](int id, Branch* branch) {
+        for(const auto& triple : branch->child_triple) settle(triple);
+    });
+    for(Triple* triple : root) {
+        if(client->stash_.find(triple->id) != nullptr) continue;
+        if(top) triple->store(target_level, 0);
+        else triple->raise_level(target_level);
+    }
+}
+
+// Level that the data fetched now will be evicted to. While a rebuild is in flight the merged levels are
+// still visible, so predict from the state after the swap: [min_level_, T) empty and T occupied.
+int HOTree::NextEvictionLevel() {
+    if (!rebuild_in_flight_) return client_->get_first_empty_level();
+    if (rebuild_target_level_ > client_->min_level_) return client_->min_level_;
+    for(int level_i = rebuild_target_level_ + 1; level_i <= client_->max_level_; level_i++) {
+        if(client_->vec_hotree_level_i_is_empty_[level_i]) return level_i;
+    }
+    return client_->max_level_;
+}
+
+// 每一层两个探测位置 (真实或随机) 先全部算好，再一次性从各层表中取回，对应模型里的一次往返 (round trip += 0.5)
+void HOTree::FetchLevelProbes(std::vector<LevelProbe>& probes) {
+    for(auto& probe : probes) {
+        const auto& table = vec_hashtable_[probe.level]->table;
+        probe.b1 = table[probe.p1].branch;
+        probe.b2 = table[probe.p2].branch;
+    }
+}
+
 Branch* HOTree::Access(uint64_t id, int counter_for_lastest_data, int level_i, int user_id) {
     uint64_t id_counter_combine = combine_unique(id, counter_for_lastest_data);
     Branch* result_branch = nullptr;
@@ -287,47 +595,44 @@ Branch* HOTree::Access(uint64_t id, int counter_for_lastest_data, int level_i, i
     // client_->communication_round_trip_ = client_->communication_round_trip_ + 0.5; 
     // client_->counter_access_++; 
 
+    // 1. 计算所有非空层的探测位置：预测层用真实哈希，其它层用随机位置 (dummy)
+    //    按层序生成，每个用户的随机数序列与逐层访问时一致
+    thread_local std::vector<LevelProbe> probes;
+    probes.clear();
     for(int i = client_->min_level_; i < client_->vec_hotree_level_i_is_empty_.size(); i++) {
-        if(client_->vec_hotree_level_i_is_empty_[i]) {
-            continue; 
+        if(client_->vec_hotree_level_i_is_empty_[i]) continue;
+        size_t capacity = vec_hashtable_[i]->getTableCapacity();
+        if(i == level_i) {
+            // compute_hash 通常是纯计算，天然线程安全
+            probes.push_back({i, client_->compute_hash1(id_counter_combine, i, capacity),
+                                 client_->compute_hash2(id_counter_combine, i, capacity)});
+        } else {
+            // 【修改】传入 user_id 使用线程独立的随机生成器
+            size_t p1 = client_->getRandomIndex(capacity, user_id);
+            size_t p2 = client_->getRandomIndex(capacity, user_id);
+            probes.push_back({i, p1, p2});
         }
-        else {
-            if(i == level_i) {
-                // compute_hash 通常是纯计算，天然线程安全
-                size_t p1 = client_->compute_hash1(id_counter_combine, i, vec_hashtable_[i]->getTableCapacity());
-                size_t p2 = client_->compute_hash2(id_counter_combine, i, vec_hashtable_[i]->getTableCapacity());
+    }
+    // 【原子操作】
+    // client_->communication_volume_ = client_->communication_volume_ + probes.size()*BlockSize*2;
 
-                // 【原子操作】
-                // client_->communication_volume_ = client_->communication_volume_ + BlockSize*2;
+    // 2. 一次取回全部层的块
+    FetchLevelProbes(probes);
 
-                // find_hotree 只要是只读查询，就是线程安全的
-                auto vec_temp_branch = vec_hashtable_[i]->find_hotree(id, p1, p2);
+    // 3. 只有预测层上的块可能命中
+    for(auto& probe : probes) {
+        if(probe.level != level_i) continue;
+        for(Branch* elem : {probe.b1, probe.b2}) {
+            if(elem != nullptr && elem->id == id && elem->counter_for_lastest_data == counter_for_lastest_data) {
+                result_branch = new Branch(elem);
                 
-                for(auto& elem : vec_temp_branch) {
-                    if(elem != nullptr) {
-                        if(elem->id == id && elem->counter_for_lastest_data == counter_for_lastest_data) {
-                            result_branch = new Branch(elem);
-                            
-                            // 【关键】加锁保护 all_branchs
-                            // 这是一个很小的临界区，只会锁这一下，不会影响整体并行度
-                            {
-                                std::lock_guard<std::mutex> lock(all_branchs_mtx_);
-                                all_branchs.push_back(result_branch);
-                            }
-                        }
-                    }
+                // 【关键】加锁保护 all_branchs
+                // 这是一个很小的临界区，只会锁这一下，不会影响整体并行度
+                {
+                    std::lock_guard<std::mutex> lock(all_branchs_mtx_);
+                    all_branchs.push_back(result_branch);
                 }
             }
-            else {
-                // 【修改】传入 user_id 使用线程独立的随机生成器
-                size_t p1 = client_->getRandomIndex(vec_hashtable_[i]->getTableCapacity(), user_id);
-                size_t p2 = client_->getRandomIndex(vec_hashtable_[i]->getTableCapacity(), user_id);
-                
-                // 【原子操作】
-                // client_->communication_volume_ = client_->communication_volume_ + BlockSize*2;
-                
-                auto vec_temp_branch = vec_hashtable_[i]->find_hotree(id, p1, p2);
-            }
         }
     }
     return result_branch;
@@ -359,36 +664,44 @@ Branch* HOTree::Self_healing_Access(int id, int counter_for_lastest_data, int pr
     }
     if(result_branch != nullptr) return result_branch;
 
-    // 2. 查找 Server Tables
+    // 2. 查找 Server Tables：预测层及以上的每个非空层都按真实哈希探测，一次取回
+    uint64_t id_counter_combine = combine_unique(id, counter_for_lastest_data);
+    thread_local std::vector<LevelProbe> probes;
+    probes.clear();
     for(int i = prediction_level; i < client_->vec_hotree_level_i_is_empty_.size(); i++) {
-        if(!client_->vec_hotree_level_i_is_empty_[i]) {
-            if(result_branch == nullptr) {
-                // ... hash 计算 ...
-                size_t p1 = client_->compute_hash1(combine_unique(id, counter_for_lastest_data), i, vec_hashtable_[i]->getTableCapacity());
-                size_t p2 = client_->compute_hash2(combine_unique(id, counter_for_lastest_data), i, vec_hashtable_[i]->getTableCapacity());
+        if(client_->vec_hotree_level_i_is_empty_[i]) continue;
+        size_t capacity = vec_hashtable_[i]->getTableCapacity();
+        probes.push_back({i, client_->compute_hash1(id_counter_combine, i, capacity),
+                             client_->compute_hash2(id_counter_combine, i, capacity)});
+    }
+    // 【原子操作】
+    // client_->communication_volume_ = client_->communication_volume_ + probes.size()*BlockSize*2;
+    FetchLevelProbes(probes);
+
+    // 3. 取回的块逐个解密 (解密到副本：表里的密文可能正被其它用户读取或被重建克隆，不能原地改写)。
+    // 这里已在 num_users 个查询线程之一里，不再开 OpenMP 线程组，以免线程数超过核数
+    thread_local std::vector<std::string> plains;
+    plains.assign(probes.size() * 2, std::string());
+    int block_count = static_cast<int>(plains.size());
+    for(int j = 0; j < block_count; j++) {
+        const LevelProbe& probe = probes[j / 2];
+        Branch* elem = (j % 2 == 0) ? probe.b1 : probe.b2;
+        if(elem != nullptr) plains[j] = client_->cryptor_->aes_decrypt(elem->trueData, probe.level);
+    }
 
-                auto vec_temp_branch = vec_hashtable_[i]->find_hotree(id, p1, p2);
-                
-                // 【原子操作】
-                int level_num_is_not_empty = count(client_->vec_hotree_level_i_is_empty_.begin() + client_->min_level_, client_->vec_hotree_level_i_is_empty_.begin() + client_->max_level_ + 1, false);
-                // client_->communication_volume_ = client_->communication_volume_ + level_num_is_not_empty*BlockSize*2;
-
-                for(auto& elem : vec_temp_branch) {
-                    if(elem != nullptr) {
-                        elem->trueData = client_->cryptor_->aes_decrypt(elem->trueData, i);
-                        if(elem->id == id && elem->counter_for_lastest_data == counter_for_lastest_data) {
-                            result_branch = new Branch(elem);
-                            
-                            // 【关键】加锁
-                            {
-                                std::lock_guard<std::mutex> lock(all_branchs_mtx_);
-                                all_branchs.push_back(result_branch);
-                            }
-                            return result_branch;
-                        }
-                    }   
-                }
+    // 4. 按层序取第一个命中
+    for(int j = 0; j < block_count; j++) {
+        Branch* elem = (j % 2 == 0) ? probes[j / 2].b1 : probes[j / 2].b2;
+        if(elem != nullptr && elem->id == id && elem->counter_for_lastest_data == counter_for_lastest_data) {
+            result_branch = new Branch(elem);
+            result_branch->trueData = std::move(plains[j]);
+            
+            // 【关键】加锁
+            {
+                std::lock_guard<std::mutex> lock(all_branchs_mtx_);
+                all_branchs.push_back(result_branch);
             }
+            return result_branch;
         }
     }
     return result_branch;
@@ -503,134 +816,146 @@ Branch* HOTree::Self_healing_Access(int id, int counter_for_lastest_data, int pr
 //     return result_branch;
 // }
 
-// 【修改】Retrieve 函数
-Branch* HOTree::Retrieve(Client* client_, Triple*& triple, std::shared_lock<std::shared_mutex>& read_lock, int user_id) {
-    Branch* child_branch = nullptr;
-    int id = triple->id;
-    int level_i = triple->level;
+// 按 triple 当前的预测位置查找一次：共享 stash、快照 stash、level stash，最后是 ORAM Access / Self-healing
+Branch* HOTree::FetchBranch(int id, Triple::Position position, int user_id, bool& found_in_stash) {
+    int level_i = position.level;
+    int counter_for_lastest_data = position.counter_for_lastest_data;
 
     // ---------------------------------------------------------
-    // 1. ID 检测机制：检查所有用户的 Stash (Cross-Stash Check)
+    // 1. ID 检测机制：所有用户共享一张无锁 stash，按 id 查一次 (Cross-Stash Check)
     // ---------------------------------------------------------
-    // 这是一个读操作，需要锁，但因为只是 map 查找，速度很快
-    for(int i = 0; i < client_->num_users_; ++i) {
-        std::lock_guard<std::mutex> lg(*client_->user_stash_mtxs_[i]);
-        auto& target_stash = client_->user_stashes_[i];
-        auto it = target_stash.find(id);
-        if(it != target_stash.end()) {
-            child_branch = it->second;
-            // 找到了！直接使用，不需要把数据移动到当前用户的 stash
-            // 保持它在原来的位置即可，因为 stash 只是暂存区
-            break; 
+    // 找到了就直接使用，stash 只是暂存区，不需要移动
+    Branch* child_branch = client_->stash_.find(id);
+    found_in_stash = (child_branch != nullptr);
+    if(child_branch != nullptr) return child_branch;
+
+    // 后台重建期间再查快照 stash：它是只读的 (后台线程正在克隆)，命中后拷贝一份，后续更新写在拷贝上
+    if(rebuild_in_flight_) {
+        auto it = client_->evicting_stash_.find(id);
+        if(it != client_->evicting_stash_.end()) {
+            child_branch = new Branch(it->second);
+            std::lock_guard<std::mutex> lock(all_branchs_mtx_);
+            all_branchs.push_back(child_branch);
+            return child_branch;
         }
     }
 
     // ---------------------------------------------------------
     // 2. 检查 Level Stash (这部分逻辑保持不变)
     // ---------------------------------------------------------
-    if(child_branch == nullptr) {
+    {
         std::lock_guard<std::mutex> lg(*client_->level_stash_mtxs_[level_i]);
         auto& level_stash = client_->vector_every_level_stash_[level_i];
         auto it = std::find_if(level_stash.begin(), level_stash.end(), [&](Branch* b) {
-            return b != nullptr && b->id == id && b->counter_for_lastest_data == triple->counter_for_lastest_data;
+            return b != nullptr && b->id == id && b->counter_for_lastest_data == counter_for_lastest_data;
         });
         if (it != level_stash.end()) {
-            child_branch = *it;
             // level_stash.erase(it); // 建议此处不要 erase，等 Eviction 统一清空，或者加更复杂的锁
+            return *it;
         }
     }
 
     // ---------------------------------------------------------
     // 3. ORAM Access (如果没有在任何 Stash 中找到)
     // ---------------------------------------------------------
-    if(child_branch == nullptr) {
-        child_branch = Access(id, triple->counter_for_lastest_data, level_i, user_id);
-        if(child_branch) {
-            child_branch->trueData = client_->cryptor_->aes_decrypt(child_branch->trueData, level_i);
-        } else {
-            child_branch = Self_healing_Access(id, triple->counter_for_lastest_data, level_i, user_id);
-        }
+    child_branch = Access(id, counter_for_lastest_data, level_i, user_id);
+    if(child_branch) {
+        child_branch->trueData = client_->cryptor_->aes_decrypt(child_branch->trueData, level_i);
+    } else {
+        child_branch = Self_healing_Access(id, counter_for_lastest_data, level_i, user_id);
     }
+    return child_branch;
+}
 
-    // 更新元数据
-    child_branch->level = -1;
-    triple->level = client_->get_first_empty_level();
-    triple->counter_for_lastest_data++;
-    child_branch->counter_for_lastest_data = triple->counter_for_lastest_data;
+// 【修改】Retrieve 函数
+Branch* HOTree::Retrieve(Client* client_, Triple*& triple, std::shared_lock<std::shared_mutex>& read_lock, int user_id) {
+    Branch* child_branch = nullptr;
+    bool found_in_stash = false;
+    int id = triple->id;
+
+    // 并发时同一个 id 可能刚被其它用户取走 (level stash 中已摘除，或 triple 计数已前进)：
+    // 对方会先把节点发布到共享 stash 再更新 triple，这里等它出现；triple 变了就按新位置重新查找。
+    // 持读锁期间不会换层，triple 在所有副本间共享，超过重试上限仍未找到说明数据已丢失
+    Triple::Position position = triple->load();
+    child_branch = FetchBranch(id, position, user_id, found_in_stash);
+    for(int spin = 0; child_branch == nullptr; spin++) {
+        if(spin == stash_retry_limit) {
+            throw std::runtime_error("Retrieve: id " + std::to_string(id) + " not found at level " +
+                                     std::to_string(position.level) + " with counter " +
+                                     std::to_string(position.counter_for_lastest_data));
+        }
+        Triple::Position current = triple->load();
+        if(!(current == position)) {
+            position = current;
+            child_branch = FetchBranch(id, position, user_id, found_in_stash);
+            continue;
+        }
+        child_branch = client_->stash_.find(id);
+        if(child_branch != nullptr) found_in_stash = true;
+        else std::this_thread::yield();
+    }
 
     // ---------------------------------------------------------
-    // 4. 写入当前用户的 Stash
+    // 4. 写入共享 Stash
     // ---------------------------------------------------------
+    // 只有新取回的节点需要插入；若其它用户抢先发布了同一个 id，改用已发布的节点，
+    // 保证每个 id 在 stash 中只有一份，triple 只对应这一份
     bool inserted_new = false;
-    
-    // 如果刚才是在别人的 stash 里找到的，我们是否要移动到自己的 stash？
-    // 为了简化逻辑和减少锁竞争，通常策略是：
-    // 如果已经在某个 stash 里了，就不用动了（update in place）。
-    // 如果是新从 Tree 里拿出来的，才放入 current user stash。
-    
-    // 简单起见，我们检查它是否已经在任何 stash 里（上面的步骤1已经查过了）
-    // 但为了严谨，我们需要确定 child_branch 是否已经在 map 中。
-    // 这里采用简单策略：只有当 child_branch 不在任何 stash 时才插入。
-    // 由于我们是指针操作，如果步骤1找到了，child_branch 就是那个指针，它已经在 map 里了。
-    
-    // 我们需要一个标记来判断是否需要 insert
-    bool already_in_stash = false;
-    // (实际上，可以通过检查 child_branch 的来源判断，但为了代码简洁，这里做个简化假设：
-    // 如果是从 Access() 返回的，或者还没有 owner，则加入)
-
-    // 更高效的做法：再次检查当前用户 stash (双重检查) 或者 只要是指针地址没变就不管
-    // 这里演示最标准的：只有新获取的数据才放入自己的 stash
-    
-    // 检查这个指针是否已经在当前用户的 stash 里（避免重复计数）
-    {
-        std::lock_guard<std::mutex> lg(*client_->user_stash_mtxs_[user_id]);
-        if(client_->user_stashes_[user_id].find(id) == client_->user_stashes_[user_id].end()) {
-            // 如果它也不在其他用户的 stash 里（这需要比较复杂的判断，或者我们就允许少量冗余）
-            // 既然用户建议“已经在其他stash中就不查了”，说明这里我们可以认为：
-            // 如果步骤1找到了，就不执行这里的插入。
-            
-            // 怎么判断步骤1是否找到？
-            // 可以加一个 flag。让我们优化一下逻辑流。
+    if(!found_in_stash) {
+        Branch* existing = client_->stash_.insert(id, child_branch);
+        if(existing != nullptr) {
+            child_branch = existing;
+        } else {
+            inserted_new = true;
         }
     }
-    
-    // --- 修正后的写入逻辑 ---
-    // 我们可以在步骤1加一个 flag `found_in_stash`
-    // if (!found_in_stash) { ... Access ...;  Lock(user_stash); insert; count++; }
-    
-    // 假设上面加了 flag，这里执行写入：
-    // 只有当它是从 Access 新拿出来的，才放入当前用户的 stash
-    // 这里的判断条件略微复杂，为了演示，假设我们需要插入：
-    {
-         std::lock_guard<std::mutex> lg(*client_->user_stash_mtxs_[user_id]);
-         // 只有当 ID 不存在时才插入
-         if (client_->user_stashes_[user_id].find(id) == client_->user_stashes_[user_id].end()) {
-             // 还需要再遍历一次其他 stash 确认吗？不用，因为如果步骤1没找到， Access 后它就是新的。
-             // 但并发环境下，可能别人刚才插入了。为了绝对一致性，可以允许少量重复，或者再次检查。
-             // 这里选择：允许放入当前 stash，最后 atomic count 增加。
-             
-             client_->user_stashes_[user_id][id] = child_branch;
-             inserted_new = true;
-         }
-         // 如果已经在自己的 stash 里，直接 update (Branch 是指针，内容已更，无需 map 操作)
-    }
-
-    // 5. 触发全局驱逐
+
+    // 更新元数据
+    // 多个用户可能同时取回同一个 id：(level, counter) 一起原子推进，节点上只保留最大值，保证与 triple 一致
+    std::atomic_ref<int>(child_branch->level).store(-1);
+    int next_counter = triple->advance(NextEvictionLevel());
+    std::atomic_ref<int> branch_counter(child_branch->counter_for_lastest_data);
+    int cur_counter = branch_counter.load();
+    while(cur_counter < next_counter && !branch_counter.compare_exchange_weak(cur_counter, next_counter)) {}
+
+    // 5. 触发全局驱逐：计数写在本用户的分片上，每 stash_trigger_stride 次插入汇总一次
     bool needs_eviction = false;
     if (inserted_new) {
-        int total = client_->current_total_stash_size_.fetch_add(1) + 1;
-        if (total >= Z) {
-            needs_eviction = true;
+        int local = client_->stash_shards_[user_id].count.fetch_add(1, std::memory_order_relaxed) + 1;
+        if (local % stash_trigger_stride == 0) {
+            int total = client_->stash_size();
+            // 后台重建进行中时先不触发，stash 继续接收数据直到 background_stash_limit
+            if (total >= Z && (!rebuild_in_flight_ || total >= background_stash_limit)) {
+                needs_eviction = true;
+            }
+        }
+    }
+
+    // 分步重建：每隔固定次数的 Retrieve 推进固定数量的工作单元，其它用户正在推进时直接跳过。
+    // 这里只持读锁、且本身运行在查询线程里，所以串行推进，不再开 OpenMP 线程组
+    if (eviction_mode_ == EvictionMode::Incremental && rebuild_in_flight_ && !rebuild_ready_.load() &&
+        (rebuild_access_count_.fetch_add(1) + 1) % incremental_step_interval == 0) {
+        std::unique_lock<std::mutex> step_lock(rebuild_step_mtx_, std::try_to_lock);
+        if (step_lock.owns_lock()) {
+            StepRebuild(client_, incremental_units_per_step, false);
         }
     }
 
-    if (needs_eviction) {
+    // 后台重建完成后也在这里升级为写锁换层
+    if (needs_eviction || rebuild_ready_.load()) {
         read_lock.unlock(); // 释放读锁
         {
             std::unique_lock<std::shared_mutex> write_lock(rw_mutex_);
-            if (client_->current_total_stash_size_.load() >= Z) {
-                Eviction(client_);
-                client_->current_total_stash_size_.store(0);
+            if (rebuild_ready_.load()) {
+                CommitBackgroundEviction(client_);
+            }
+            if (client_->stash_size() >= Z) {
+                if (eviction_mode_ == EvictionMode::StopTheWorld) {
+                    Eviction(client_);
+                    client_->reset_stash_size();
+                } else {
+                    BeginBackgroundEviction(client_);
+                }
             }
         }
         read_lock.lock(); // 恢复读锁
@@ -721,6 +1046,8 @@ vector<pair<double, DataRecord>> HOTree::SearchTopK(double qx, double qy, string
     std::shared_lock<std::shared_mutex> read_lock(rw_mutex_);
     vector<pair<double, DataRecord>> results;
     if (root.size() == 0 || k <= 0) return results;
+    // 登记查询起始 epoch，返回前注销
+    uint64_t query_epoch = EnterQueryEpoch();
 
     // 1. 构建查询节点
     Branch* queryBranch = new Branch();
@@ -784,7 +1111,7 @@ vector<pair<double, DataRecord>> HOTree::SearchTopK(double qx, double qy, string
             size_t child_count = curr->child_triple.size();
             
             for (size_t i = 0; i < child_count; i++) {
-                Triple* child_t = curr->child_triple[i];
+                Triple* child_t = curr->child_triple[i].get();
                 
                 // --- 模拟计算分数 (不进行 Retrieve) ---
                 // 我们需要一个临时的 Branch 对象来辅助计算，或者重载 CalcuTestSPaceRele
@@ -813,6 +1140,7 @@ vector<pair<double, DataRecord>> HOTree::SearchTopK(double qx, double qy, string
         // 此处逻辑需根据 Retrieve 的内存管理策略微调。
     }
     delete queryBranch;
+    ExitQueryEpoch(query_epoch);
     return results;
 }
 
@@ -875,8 +1203,7 @@ void HOTree::Build(vector<DataRecord>& raw_data, Client* &client) {
         //MAX_SIZE个数据放在一个节点m_node中，这个node包含这些branch的矩形
         for (int i = current_idx; i < end_idx; i++) {
             Branch* b = position_branchs[i];
-            Triple* temp_triple = new Triple(b->id, 0, 0);
-            parent_branch->child_triple.push_back(temp_triple);
+            parent_branch->child_triple.push_back(make_shared<Triple>(b->id, 0, 0));
             parent_branch->child_branch.push_back(b);
             parent_branch->rectUpdate(b); 
             parent_branch->child_rects.push_back(b->m_rect);
@@ -905,8 +1232,7 @@ void HOTree::Build(vector<DataRecord>& raw_data, Client* &client) {
                 parent->keyWeightUpdate(childBranch);
                 // record parent infomation
                 parent->rectUpdate(childBranch); // 更新父节点 MBR
-                Triple* temp_triple = new Triple(childBranch->id, 0, 0);
-                parent->child_triple.push_back(temp_triple);
+                parent->child_triple.push_back(make_shared<Triple>(childBranch->id, 0, 0));
                 parent->child_branch.push_back(childBranch);
 
                 // [修改点2] 关键：将孩子的摘要信息保存到父节点中
@@ -935,7 +1261,7 @@ void HOTree::Build(vector<DataRecord>& raw_data, Client* &client) {
     int l = ceil(log2(Z));   //the lowest level
     int L = ceil(log2(N)); //the top level
     for(auto & triple : root) {
-        triple->level = L;
+        triple->store(L, 0);
     }
     client_ = new Client(L);
     client_->min_level_ = l;
@@ -958,7 +1284,7 @@ void HOTree::Build(vector<DataRecord>& raw_data, Client* &client) {
         branch->trueData = client_->cryptor_->aes_encrypt(padZero(branch->text), L); // ciphertext, it has been padded to blocksize before encrypting
         // update the child level
         for(auto& triple : branch->child_triple) {
-            triple->level = L;
+            triple->store(L, 0);
         }
         
         // insert
@@ -3,6 +3,7 @@
 #include <map>
 #include <algorithm>
 #include <functional>
+#include <thread>
 #include "define.h"
 #include "DataReader.h"
 #include "cryptor.h"
@@ -26,6 +27,41 @@ public:
     mutable std::shared_mutex rw_mutex_;
     // 【新增】保护 all_branchs 的互斥锁
     std::mutex all_branchs_mtx_; 
+
+    // 去摊销驱逐 (EvictionMode::Background / Incremental)：
+    // 后台线程 (或 Retrieve 分步) 把快照重建到 rebuild_table_ (对读者不可见)，完成后置 rebuild_ready_，
+    // 由下一次 Retrieve 持写锁换层。rebuild_* 字段只在写锁下或由正在推进重建的一方独占修改
+    EvictionMode eviction_mode_ = default_eviction_mode;
+    std::thread rebuild_thread_;
+    bool rebuild_in_flight_ = false;
+    std::atomic<bool> rebuild_ready_{false};
+    int rebuild_target_level_ = -1;
+    std::vector<int> rebuild_source_levels_;        // 并入目标层的旧层 (换层前仍对读者可见)
+    // 快照时各用户 stash 中的全部节点 (含同 id 的多个版本)。快照后它们只读：读者从 evicting_stash_ 取回时
+    // 先拷贝，triple 的更新落在共享的 triple 上，所以重建线程可以不加锁地克隆它们
+    std::vector<Branch*> rebuild_stash_;
+    std::vector<Branch*> rebuild_level_stash_;      // 各旧层 level stash 的克隆
+    std::vector<int> rebuild_level_stash_belong_to_;
+    std::vector<Branch*> rebuild_retired_;          // 旧层表中被克隆的原节点，换层后释放
+    std::unique_ptr<CuckooTable> rebuild_table_;
+    // 重建输入 (旧层表的克隆) 的准备进度，克隆完才登记到 all_branchs 并开始 shuffle
+    std::vector<Branch*> rebuild_input_;
+    std::vector<int> rebuild_input_belong_to_;
+    size_t rebuild_clone_level_ = 0;
+    size_t rebuild_clone_pos_ = 0;
+    bool rebuild_input_ready_ = false;
+    std::mutex rebuild_step_mtx_;                   // Incremental：同一时刻只有一个读者推进重建
+    std::atomic<int> rebuild_access_count_{0};      // Incremental：本轮重建开始后的 Retrieve 次数
+
+    // 查询在 Retrieve 中途会让出读锁 (升级写锁驱逐)，其优先队列里仍持有节点的 triple 指针：
+    // GC / 换层释放的节点先挂起，等所有在释放之前开始的查询结束后再 delete (epoch-based reclamation)
+    // 同一个 user_id 可能同时被多个线程使用，所以按起始 epoch 计数进行中的查询，而不是每个用户一个槽位；
+    // 计数按 epoch % kEpochSlots 分槽，相隔 kEpochSlots 的 epoch 共用一个计数，只会让回收更保守
+    static constexpr int kEpochSlots = 64;
+    std::atomic<uint64_t> reclaim_epoch_{1};
+    std::atomic<int> active_queries_[kEpochSlots] = {};
+    uint64_t oldest_active_epoch_ = 1;              // 仍可能有查询在进行的最早 epoch (写锁下推进)
+    std::vector<std::pair<uint64_t, Branch*>> retired_branchs_;
     
 public:
     HOTree(const std::vector<std::string>& dict);
@@ -33,15 +69,34 @@ public:
     
     void Build(std::vector<DataRecord>& raw_data, Client*& client);
     void Eviction(Client* client);
+    void BeginBackgroundEviction(Client* client);
+    void RunBackgroundEviction(Client* client);
+    bool StepRebuild(Client* client, long long work_units, bool parallel = true);
+    void CommitBackgroundEviction(Client* client);
+    int NextEvictionLevel();
+    void SettleTriples(int target_level, Client* client);
     Client* getClient();
     Branch* Retrieve(Client* client_, Triple*& triple, std::shared_lock<std::shared_mutex>& read_lock, int user_id);
+    Branch* FetchBranch(int id, Triple::Position position, int user_id, bool& found_in_stash);
     std::vector<std::pair<double, DataRecord>> SearchTopK(double qx, double qy, std::string qText, int k, Client* client, int user_id);
 
     // std::vector<std::pair<double, DataRecord>> SearchTopK(double qx, double qy, std::string qText, int k, Client* client);
     // Branch* Retrieve(Client* client_, Triple*& triple);
     Branch* Access(uint64_t id, int counter_for_lastest_data, int level_i, int user_id);
     Branch* Self_healing_Access(int id, int counter_for_lastest_data, int prediction_level, int user_id);
+    // 一次 Access 中某一层的两个探测位置及取回的块
+    struct LevelProbe {
+        int level;
+        size_t p1, p2;
+        Branch* b1 = nullptr;
+        Branch* b2 = nullptr;
+    };
+    void FetchLevelProbes(std::vector<LevelProbe>& probes);
     void PerformGarbageCollection(int target_level);
+    void RetireBranch(Branch* branch);
+    void ReclaimRetiredBranchs();
+    uint64_t EnterQueryEpoch();
+    void ExitQueryEpoch(uint64_t epoch);
 
     // for debug
     std::vector<double> GetTextWeight(std::string text);
@@ -0,0 +1,61 @@
+#include "stash.h"
+#include <stdexcept>
+#include <cstdint>
+#include <thread>
+
+ConcurrentStash::ConcurrentStash(size_t min_capacity) {
+    size_t capacity = 1;
+    shift_ = 64;
+    while (capacity < min_capacity) {
+        capacity <<= 1;
+        shift_--;
+    }
+    slots_ = std::make_unique<Slot[]>(capacity);
+    mask_ = capacity - 1;
+}
+
+// Fibonacci hashing：id 连续 (同一棵子树的节点) 时也能均匀散开
+size_t ConcurrentStash::slot_of(int id) const {
+    uint64_t h = static_cast<uint64_t>(static_cast<uint32_t>(id)) * 0x9E3779B97F4A7C15ull;
+    return shift_ >= 64 ? 0 : static_cast<size_t>(h >> shift_);
+}
+
+// 认领 key 与发布 value 之间只隔一条 store，等待时间极短
+Branch* ConcurrentStash::wait_value(const Slot& slot) const {
+    Branch* value;
+    while ((value = slot.value.load(std::memory_order_acquire)) == nullptr) {
+        std::this_thread::yield();
+    }
+    return value;
+}
+
+Branch* ConcurrentStash::find(int id) const {
+    for (size_t i = slot_of(id), probes = 0; probes <= mask_; i = (i + 1) & mask_, probes++) {
+        int key = slots_[i].key.load(std::memory_order_acquire);
+        if (key == kEmptyKey) return nullptr;
+        if (key == id) return wait_value(slots_[i]);
+    }
+    return nullptr;
+}
+
+Branch* ConcurrentStash::insert(int id, Branch* branch) {
+    for (size_t i = slot_of(id), probes = 0; probes <= mask_; i = (i + 1) & mask_, probes++) {
+        int key = slots_[i].key.load(std::memory_order_acquire);
+        if (key == kEmptyKey) {
+            if (slots_[i].key.compare_exchange_strong(key, id, std::memory_order_acq_rel)) {
+                slots_[i].value.store(branch, std::memory_order_release);
+                return nullptr;
+            }
+            // CAS 失败时 key 是抢先认领者的 id
+        }
+        if (key == id) return wait_value(slots_[i]);
+    }
+    throw std::runtime_error("client stash is full");
+}
+
+void ConcurrentStash::clear() {
+    for (size_t i = 0; i <= mask_; i++) {
+        slots_[i].key.store(kEmptyKey, std::memory_order_relaxed);
+        slots_[i].value.store(nullptr, std::memory_order_relaxed);
+    }
+}
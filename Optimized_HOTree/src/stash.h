@@ -0,0 +1,42 @@
+#pragma once
+#include <atomic>
+#include <climits>
+#include <cstddef>
+#include <memory>
+#include "Branch.h"
+
+// 所有用户共享的 client stash：id -> Branch* 的开放寻址哈希表 (线性探测)。
+// 持 HOTree 读锁的查询线程之间 find / insert 无锁：先用 CAS 认领槽位的 key，再发布 value，
+// 表内不做删除。for_each / clear 只在写锁下调用 (驱逐、换层)，此时没有并发的 find / insert。
+class ConcurrentStash {
+public:
+    explicit ConcurrentStash(size_t min_capacity);
+
+    Branch* find(int id) const;
+    // id 不存在时插入 branch 并返回 nullptr；已存在 (例如其它用户刚取回同一个节点) 时返回已发布的节点
+    Branch* insert(int id, Branch* branch);
+    void clear();
+    size_t capacity() const { return mask_ + 1; }
+
+    template <typename F>
+    void for_each(F&& f) const {
+        for (size_t i = 0; i <= mask_; i++) {
+            Branch* value = slots_[i].value.load(std::memory_order_relaxed);
+            if (value != nullptr) f(slots_[i].key.load(std::memory_order_relaxed), value);
+        }
+    }
+
+private:
+    static constexpr int kEmptyKey = INT_MIN;
+    struct Slot {
+        std::atomic<int> key{kEmptyKey};
+        std::atomic<Branch*> value{nullptr};
+    };
+
+    size_t slot_of(int id) const;
+    Branch* wait_value(const Slot& slot) const;
+
+    std::unique_ptr<Slot[]> slots_;
+    size_t mask_;
+    int shift_;
+};